@@ -0,0 +1,81 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+// Scratch memory for temporary buffers of interpolation calls: a bump
+// arena per thread, taken from with allocate and rewound as a whole when
+// the enclosing Scope ends. Nothing is freed on the hot path: if a call
+// needs more than the arena holds, the excess is taken from heap, and
+// on the end of the outermost scope the arena is enlarged to the
+// high-water mark, so that later calls fit.
+//
+// Arenas belong to the threads using them, not to devices: an arena is
+// first touched, and placed, on the node the thread runs on when it first
+// needs scratch (for a Coalescer leader, the node of that caller thread).
+// SCRATCH_SIZE environment variable sets the initial size of every
+// arena in KB (256 by default). The largest high-water mark over all
+// threads is reported by performance counters, and by getScratchHighWater.
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace cpu {
+
+class Arena
+{
+	char* base;
+	size_t size, offset;
+
+	// Blocks taken from heap, when arena is exhausted, with their sizes.
+	std::vector<std::pair<void*, size_t> > overflow;
+
+	// Bytes in use, including overflow, and their maximum ever.
+	size_t used, highWater;
+
+	// Number of open scopes.
+	int depth;
+
+	Arena* next;
+
+	Arena();
+
+	// Rewind to the state at the beginning of scope.
+	void rewind(size_t offset, size_t used);
+
+public :
+
+	// Get arena of the calling thread, creating it on first use.
+	static Arena& get();
+
+	// Allocate uninitialized memory, aligned by the given number of bytes
+	// (power of two), valid until the end of the current scope.
+	void* allocate(size_t size, size_t alignment = 64);
+
+	template<typename T>
+	inline __attribute__((always_inline)) T* allocate(size_t count)
+	{
+		return (T*)allocate(count * sizeof(T));
+	}
+
+	size_t getHighWater() const;
+
+	// The largest high-water mark among arenas of all threads.
+	static size_t getMaxHighWater();
+
+	// Memory allocated within scope is released at its end.
+	class Scope
+	{
+		Arena& arena;
+		size_t offset, used;
+
+	public :
+
+		Scope(Arena& arena);
+
+		~Scope();
+	};
+};
+
+} // namespace cpu
+
+#endif // ARENA_H
@@ -0,0 +1,79 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+// Asynchronous interpolation. submit queues a request and returns at once,
+// so that the caller could go on with its own work, and pipeline many
+// independent points. Worker threads (ASYNC_WORKERS, 1 by default) drain
+// the queue: requests for the same device, data, state and Dof range are
+// merged, up to ASYNC_BATCH points (256 by default), into one stateless
+// interpolation of many points, and results are copied back.
+//
+// Every submitted request shall be passed to wait, which blocks until
+// results are ready, and releases the request. Optional callback is called
+// by worker thread once results are ready, before request is completed,
+// thus callback must not wait for it. The same API is exported with C
+// linkage, for the Fortran solver (see the end of src/Async.cpp).
+
+#include "Data.h"
+
+#include <deque>
+#include <pthread.h>
+#include <vector>
+
+namespace cpu {
+
+class Device;
+
+class Async
+{
+public :
+
+	struct Request
+	{
+		Device* device;
+		const Data* data;
+		int istate, Dof_choice_start, Dof_choice_end, count;
+		const real* x;
+		real* value;
+
+		void (*callback)(void* arg);
+		void* arg;
+
+		int done;
+	};
+
+private :
+
+	std::deque<Request*> queue;
+	std::vector<pthread_t> threads;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t wake, completed;
+
+	int maxBatch;
+
+	Async();
+
+	static void* worker(void* async);
+
+	// Interpolate the requests, packing their points into the given vectors.
+	void process(const std::vector<Request*>& batch, Vector<real>& x, Vector<real>& value);
+
+public :
+
+	static Async& getInstance();
+
+	Request* submit(Device* device, const Data* data, const int istate, const real* x,
+		const int Dof_choice_start, const int Dof_choice_end, const int count, real* value,
+		void (*callback)(void* arg) = NULL, void* arg = NULL);
+
+	// Check, if results of request are ready.
+	bool test(Request* request);
+
+	// Wait for results of request, and release it.
+	void wait(Request* request);
+};
+
+} // namespace cpu
+
+#endif // ASYNC_H
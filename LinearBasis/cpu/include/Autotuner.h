@@ -0,0 +1,60 @@
+#ifndef AUTOTUNER_H
+#define AUTOTUNER_H
+
+// Selection of the fastest kernel configuration for the loaded data, by
+// timing all candidates on a sample of points drawn from the grid itself.
+// Enabled by setting AUTOTUNE environment variable: tuning runs when the
+// solver calls tune export, once all states are loaded, and is then used by
+// every interpolation with this data. Loading itself never tunes, as tuning
+// is collective, and ranks may load data at different times.
+//
+// Candidates are instruction sets of generic kernels (see ISA.h),
+// runtime-optimized kernels, if enabled in config, and the number
+// of points per kernel call (tile) in stateless interpolation of many
+// points. AUTOTUNE_POINTS (16 by default) sets the sample size, and
+// the largest tile, AUTOTUNE_REPEAT (3 by default) the number of timed
+// runs, of which the fastest one is taken.
+//
+// Timings are summed over all ranks, so that all ranks agree on the same
+// configuration, thus all ranks shall call tune with the same data, just
+// like they all create the interpolator with runtime optimization. The result is
+// stored in the JIT cache directory (JIT_CACHE_DIR, "./.cache" by default),
+// under a hash of data and host, and is read back by later runs instead
+// of tuning again.
+
+namespace cpu {
+
+class Data;
+
+struct Tuning
+{
+	// Instruction set of generic kernels, as ISA::Kind.
+	int isa;
+
+	// Non-zero, if runtime-optimized kernels are used.
+	int jit;
+
+	// Points per kernel call in stateless interpolation of many points.
+	int tile;
+
+	// Throughput of this configuration on the sample, per rank.
+	double pointsPerSecond;
+};
+
+class Autotuner
+{
+public :
+
+	static bool isEnabled();
+
+	// Find the fastest configuration for the data with all states loaded,
+	// or read it from cache. Collective over all ranks.
+	static void tune(Data* data);
+
+	// Get configuration tuned for the data, or false, if not tuned.
+	static bool getTuning(const Data* data, Tuning* tuning);
+};
+
+} // namespace cpu
+
+#endif // AUTOTUNER_H
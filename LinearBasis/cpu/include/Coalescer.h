@@ -0,0 +1,37 @@
+#ifndef COALESCER_H
+#define COALESCER_H
+
+// Coalescing of single point interpolation calls, made by many threads at
+// once. Enabled by setting COALESCE environment variable: the first thread
+// to call for the given data, state and Dof range opens a batch, and waits
+// for COALESCE_WINDOW microseconds (10 by default), or until the batch has
+// COALESCE_BATCH points (16 by default). Threads calling meanwhile add their
+// points to the batch and sleep. The first thread then interpolates all
+// points with one stateless call, so that surplus is swept once per batch
+// instead of once per point, and wakes up the others. Points and values
+// of the batch are packed in scratch memory of the first thread (see
+// Arena.h).
+//
+// The window is a latency paid by every call, thus coalescing is only
+// worth it with many threads calling at once. Merged calls are counted,
+// profiled and recorded as stateless interpolation of many points.
+
+namespace cpu {
+
+class Data;
+class Device;
+
+class Coalescer
+{
+public :
+
+	static bool isEnabled();
+
+	// Interpolate a single point together with concurrent callers.
+	static void interpolate(Device* device, const Data* data, const int istate, const real* x,
+		const int Dof_choice_start, const int Dof_choice_end, real* value);
+};
+
+} // namespace cpu
+
+#endif // COALESCER_H
@@ -0,0 +1,106 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+// Hot-path performance counters: call counts, TSC cycles, rows visited,
+// rows active (not rejected by the early exit) and bytes streamed, kept
+// per thread and per counter kind, along with the high-water mark of
+// scratch memory per thread. Enabled with HAVE_COUNTERS only, otherwise
+// all COUNTERS_* macros expand to nothing.
+//
+// Summary over all ranks is printed by master at MPI_Finalize. Each rank
+// also writes Prometheus-style text dump into COUNTERS_DUMP.<rank> file,
+// if COUNTERS_DUMP environment variable is set.
+
+namespace cpu {
+
+enum CounterKind
+{
+	CounterDataLoad = 0,
+	CounterJITCompile,
+	CounterInterpolateValue,
+	CounterInterpolateArray,
+	CounterInterpolateArrayManyStateless,
+	CounterInterpolateArrayManyMultistate,
+	CounterKindCount
+};
+
+} // namespace cpu
+
+#ifdef HAVE_COUNTERS
+
+#include <x86intrin.h>
+
+// Kernels may be loaded from a standalone JIT-compiled shared object,
+// thus they report rows through a weak C entry point: if the library
+// symbols are not visible to the kernel, rows are simply not counted.
+extern "C" void LinearBasis_CPU_Counters_addRows(int kind,
+	unsigned long long visited, unsigned long long active, unsigned long long bytes) __attribute__((weak));
+
+namespace cpu {
+
+class Counters
+{
+public :
+
+	struct Thread
+	{
+		unsigned long long calls[CounterKindCount];
+		unsigned long long cycles[CounterKindCount];
+		unsigned long long rowsVisited[CounterKindCount];
+		unsigned long long rowsActive[CounterKindCount];
+		unsigned long long bytes[CounterKindCount];
+
+		// The largest scratch memory used at once, in bytes (see Arena.h).
+		unsigned long long scratchHighWater;
+
+		int id;
+		Thread* next;
+	};
+
+	// Get counters of the calling thread, registering them on first use.
+	static Thread& getThread();
+
+	// Register summary and dump to happen at MPI_Finalize.
+	static void initialize();
+
+	// Count a call and its duration in cycles, from construction to destruction.
+	class Scope
+	{
+		CounterKind kind;
+		unsigned long long start;
+
+	public :
+
+		inline __attribute__((always_inline)) Scope(CounterKind kind_) : kind(kind_), start(__rdtsc()) { }
+
+		inline __attribute__((always_inline)) ~Scope()
+		{
+			Thread& thread = getThread();
+			thread.calls[kind]++;
+			thread.cycles[kind] += __rdtsc() - start;
+		}
+	};
+};
+
+} // namespace cpu
+
+#define COUNTERS_SCOPE(kind) cpu::Counters::Scope counters_scope(kind)
+#define COUNTERS_BYTES(kind, n) (cpu::Counters::getThread().bytes[kind] += (n))
+#define COUNTERS_ROWS_BEGIN() unsigned long long counters_active = 0
+#define COUNTERS_ROW_ACTIVE() (counters_active++)
+#define COUNTERS_ROWS_END(kind, visited, rowIndexBytes, rowSurplusBytes) \
+	do { if (LinearBasis_CPU_Counters_addRows) LinearBasis_CPU_Counters_addRows(kind, (visited), counters_active, \
+		(unsigned long long)(visited) * (rowIndexBytes) + counters_active * (rowSurplusBytes)); } while (0)
+
+#else
+
+#define COUNTERS_SCOPE(kind)
+#define COUNTERS_BYTES(kind, n)
+#define COUNTERS_ROWS_BEGIN()
+#define COUNTERS_ROW_ACTIVE()
+#define COUNTERS_ROWS_END(kind, visited, rowIndexBytes, rowSurplusBytes)
+
+#endif // HAVE_COUNTERS
+
+#endif // COUNTERS_H
+
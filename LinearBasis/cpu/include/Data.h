@@ -7,9 +7,13 @@
 #include <cstdlib>
 #include <iostream>
 #include <string.h>
+#include <utility>
 #include <vector>
 
+#include "Autotuner.h"
 #include "check.h"
+#include "Memory.h"
+#include "Placement.h"
 #include "process.h"
 
 namespace cpu {
@@ -65,6 +69,11 @@ public:
 		size_t size = n * sizeof(T);
 		if (size % (AVX_VECTOR_SIZE * sizeof(T)))
 			size += AVX_VECTOR_SIZE * sizeof(T) - size % (AVX_VECTOR_SIZE * sizeof(T)); 
+
+		// Large storage is mapped with huge pages, already zeroed.
+		ptr = Memory::allocate(size, AVX_VECTOR_SIZE * sizeof(T));
+		if (ptr) return static_cast<pointer>(ptr);
+
 		int err = posix_memalign(&ptr, AVX_VECTOR_SIZE * sizeof(T), size);
 		if (err != 0)
 		{
@@ -84,7 +93,12 @@ public:
 
 	void deallocate(pointer ptr, size_type n)
 	{
-		free(ptr);
+		size_t size = n * sizeof(T);
+		if (size % (AVX_VECTOR_SIZE * sizeof(T)))
+			size += AVX_VECTOR_SIZE * sizeof(T) - size % (AVX_VECTOR_SIZE * sizeof(T)); 
+
+		if (!Memory::deallocate(ptr, size))
+			free(ptr);
 	}
 };
 
@@ -127,8 +141,13 @@ class Matrix
 	std::vector<T, AlignedAllocator<T> > data;
 	int dimY, dimX, dimX_aligned;
 
+	// Storage in use: either own data, or external memory adopted
+	// without copying (see adopt), which is never freed by matrix.
+	T* ptr;
+	size_t length;
+
 public :
-	Matrix() : data(AlignedAllocator<T>()), dimY(0), dimX(0) { }
+	Matrix() : data(AlignedAllocator<T>()), dimY(0), dimX(0), dimX_aligned(0), ptr(NULL), length(0) { }
 
 	Matrix(int dimY_, int dimX_) : data(AlignedAllocator<T>()), dimY(dimY_), dimX(dimX_)
 	{
@@ -136,17 +155,48 @@ public :
 		if (dimX_ % AVX_VECTOR_SIZE)
 			dimX_aligned = dimX + AVX_VECTOR_SIZE - dimX_ % AVX_VECTOR_SIZE;
 		data.resize(dimY_ * dimX_aligned);
+		ptr = data.data();
+		length = data.size();
 	}
 
-	inline __attribute__((always_inline)) T* getData() { return &data[0]; }
+	// Copy is always made into own storage, even of adopted matrix.
+	Matrix(const Matrix& other) : data(other.ptr, other.ptr + other.length, AlignedAllocator<T>()),
+		dimY(other.dimY), dimX(other.dimX), dimX_aligned(other.dimX_aligned)
+	{
+		ptr = data.data();
+		length = data.size();
+	}
+
+	Matrix& operator=(const Matrix& other)
+	{
+		if (this == &other) return *this;
+
+		dimY = other.dimY; dimX = other.dimX; dimX_aligned = other.dimX_aligned;
+		data.assign(other.ptr, other.ptr + other.length);
+		ptr = data.data();
+		length = data.size();
+		return *this;
+	}
+
+	inline __attribute__((always_inline)) T* getData() { return ptr; }
+
+	inline __attribute__((always_inline)) const T* getData() const { return ptr; }
+
+	// Size of storage in bytes, padding included.
+	inline __attribute__((always_inline)) size_t getSize() const { return length * sizeof(T); }
+
+	// Leading dimension of storage: row length with padding, in elements.
+	inline __attribute__((always_inline)) int getStride() const { return dimX_aligned; }
+
+	inline __attribute__((always_inline)) bool isAdopted() const { return ptr && (ptr != data.data()); }
 	
 	inline __attribute__((always_inline)) T& operator()(int y, int x)
 	{
 		assert(x < dimX);
 		assert(y < dimY);
 		int index = x + dimX_aligned * y;
-		assert(index < data.size());
-		return data[index];
+		assert(index < length);
+		return ptr[index];
 	}
 
 	inline __attribute__((always_inline)) const T& operator()(int y, int x) const
@@ -154,8 +204,8 @@ public :
 		assert(x < dimX);
 		assert(y < dimY);
 		int index = x + dimX_aligned * y;
-		assert(index < data.size());
-		return data[index];
+		assert(index < length);
+		return ptr[index];
 	}
 
 	inline __attribute__((always_inline)) int dimy() { return dimY; }
@@ -169,14 +219,57 @@ public :
 		if (dimX_ % AVX_VECTOR_SIZE)
 			dimX_aligned = dimX + AVX_VECTOR_SIZE - dimX_ % AVX_VECTOR_SIZE;
 		data.resize(dimY_ * dimX_aligned);
+		ptr = data.data();
+		length = data.size();
+	}
+
+	// Use external storage in place of own one, releasing the latter.
+	// Storage shall be aligned to AVX_VECTOR_SIZE elements and have rows
+	// padded just like own storage, and shall outlive its use by matrix.
+	inline __attribute__((always_inline)) void adopt(T* external, int dimY_, int dimX_)
+	{
+		dimY = dimY_; dimX = dimX_;
+		dimX_aligned = dimX_;
+		if (dimX_ % AVX_VECTOR_SIZE)
+			dimX_aligned = dimX + AVX_VECTOR_SIZE - dimX_ % AVX_VECTOR_SIZE;
+		std::vector<T, AlignedAllocator<T> >(AlignedAllocator<T>()).swap(data);
+		ptr = external;
+		length = (size_t)dimY_ * dimX_aligned;
 	}
 	
 	inline __attribute__((always_inline)) void fill(T value)
 	{
-		std::fill(data.begin(), data.end(), value);
+		std::fill(ptr, ptr + length, value);
 	}
 };
 
+// Nonzero of index in compressed format: level factor i and offset j
+// of basis function (see Data::load).
+struct IndexPair
+{
+	unsigned short i, j;
+};
+
+// Sparse matrix in compressed sparse row format: nonzeros of row r are
+// A[IA[r]] ... A[IA[r + 1] - 1], in columns JA[IA[r]] ... JA[IA[r + 1] - 1].
+template<typename T>
+struct CSR
+{
+	const T* A;
+	const int* IA;
+	const int* JA;
+};
+
+// Header of state data in POSIX shared memory object (see Data::load).
+struct SharedHeader
+{
+	char marker[16]; // "shared"
+	int dim, nno, TotalDof, Level;
+
+	// Byte offsets of index and surplus from the beginning of object.
+	long indexOffset, surplusOffset;
+};
+
 class Interpolator;
 
 class Data
@@ -185,17 +278,101 @@ class Data
 	std::vector<Matrix<int> > index;
 	std::vector<Matrix<real> > surplus, surplus_t;
 	std::vector<bool> loadedStates;
+
+	// Kernel configuration found by autotuning, if tuned.
+	Tuning tuning;
+	bool tuned;
+
+	// Placement of index and surplus over NUMA nodes, and their per-node
+	// copies, indexed by node, if data is replicated (see Placement.h).
+	Placement::Policy placement;
+	std::vector<std::vector<Matrix<int> > > indexReplicas;
+	std::vector<std::vector<Matrix<real> > > surplusReplicas;
+
+	// Shared memory mapped by state, with its size, or NULL.
+	std::vector<std::pair<void*, size_t> > mappings;
+
+	// Check the state is not loaded and the shape matches config,
+	// before the state is loaded from any source.
+	void prepare(const char* source, int istate, int dim, int nno, int TotalDof, int Level);
+
+	// Complete loading of the state, once index and surplus are filled in.
+	void finish(int istate);
+
+	// Map state data from POSIX shared memory object.
+	void loadShared(const char* name, int istate);
+
+	// Apply placement policy to the loaded state.
+	void place(int istate);
+
+	// Replica to use on the given node (-1 for the node of the calling
+	// thread), or -1 for the original.
+	inline __attribute__((always_inline)) int getReplica(int node) const
+	{
+		if (placement != Placement::Replicate) return -1;
+		if (node < 0) node = Placement::getCurrentNode();
+		if ((node >= (int)indexReplicas.size()) || indexReplicas[node].empty()) return -1;
+		return node;
+	}
+
+	inline __attribute__((always_inline)) const Matrix<int>* getIndex(int replica, int istate) const
+	{
+		if (replica < 0) return &index[istate];
+		return &indexReplicas[replica][istate];
+	}
+
+	inline __attribute__((always_inline)) const Matrix<real>* getSurplus(int replica, int istate) const
+	{
+		if (replica < 0) return &surplus[istate];
+		return &surplusReplicas[replica][istate];
+	}
 	
 	friend class Interpolator;
+	friend class Async;
+	friend class Autotuner;
+	friend class Coalescer;
+	friend class Placement;
+	friend class Server;
+	friend class Strided;
+	friend class Warmup;
 
 public :
 	virtual int getNno() const;
 
+	// Load state from file in text or compressed format, or, if filename
+	// is of the form "shm:<name>", map it from POSIX shared memory object
+	// <name> without copying. Object starts with SharedHeader, and holds
+	// index and surplus at the given offsets, in the layout of dense
+	// load below (with leading dimensions padded).
 	virtual void load(const char* filename, int istate);
 	
 	virtual void clear();
 
+	// Change placement policy, also for the states already loaded.
+	// Pages of states used in place (memory of the caller, or shared
+	// memory) are never moved, thus interleave and partition do not
+	// apply to them, while replicate does, as it copies.
+	virtual void setPlacement(Placement::Policy policy);
+
+	// Load state from dense row-major arrays in memory. Index row holds
+	// level factors i of all dimensions, followed by offsets j of basis
+	// functions starting at ldindex / 2, both as in compressed files.
+	// If leading dimensions equal the padded row lengths
+	// (2 * vdim * AVX_VECTOR_SIZE and TotalDof rounded up to
+	// AVX_VECTOR_SIZE) and arrays are aligned to AVX_VECTOR_SIZE
+	// elements, they are used in place without copying, and shall
+	// outlive the state (until clear), otherwise they are copied.
+	virtual void load(int dim, int nno, int TotalDof, int Level,
+		const int* index, int ldindex, const real* surplus, int ldsurplus, int istate);
+
+	// Load state from sparse arrays in memory, with the same contents
+	// as of compressed file. Arrays are decoded, thus not needed after.
+	virtual void load(int dim, int nno, int TotalDof, int Level,
+		const CSR<IndexPair>& index, const CSR<real>& surplus, int istate);
+
 	Data(int nstates);
+
+	virtual ~Data();
 };
 
 } // namespace cpu
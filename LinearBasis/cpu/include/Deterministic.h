@@ -0,0 +1,51 @@
+#ifndef DETERMINISTIC_H
+#define DETERMINISTIC_H
+
+// Bit-for-bit reproducible interpolation, enabled by setting DETERMINISTIC
+// environment variable. Every kernel reduces over the rows of surplus
+// sequentially, in row order, for each point on its own, and the product
+// over dimensions is taken in the same order for every row, thus the result
+// of a point depends only on the kernel code that computes it. Deterministic
+// mode removes all the choices of that code, which depend on thread count
+// or timing:
+//
+// - points of stateless interpolation are cut into blocks of a fixed size,
+//   DETERMINISTIC_BLOCK points (16 by default), independently of the number
+//   of workers, and blocks are shared between workers as a whole;
+// - runtime-optimized kernels are not used, because they are compiled in
+//   background and swapped in whenever ready, and are specialized for the
+//   number of points in a call; generic kernels are used instead;
+// - autotuning is skipped, because it picks kernels by timing, and
+//   coalescing (COALESCE) is ignored, because it merges points of
+//   concurrent calls into batches depending on their timing.
+//
+// Results are then identical for any number of workers and threads, and
+// across runs and hosts, which select the same instruction set: set CPU_ISA
+// (see ISA.h) to the same value on all hosts to compare results between
+// machines of different generations.
+//
+// Throughput cost is the speedup of runtime-optimized kernels over generic
+// ones, which the benchmark tool reports for the given dim and TotalDof
+// (the "jit" against the "generic" variant), the speedup of the autotuned
+// instruction set and tile, and that of coalescing, if it was used; no
+// JIT compilation is paid in return. Fixed blocks cost nothing while count
+// is many times DETERMINISTIC_BLOCK times the number of workers; with fewer
+// points, some workers idle, and a larger block trades balance for fewer
+// kernel calls. Results of deterministic mode may differ from those of the
+// default mode in the last bits, as the kernels differ.
+
+namespace cpu {
+
+class Deterministic
+{
+public :
+
+	static bool isEnabled();
+
+	// Number of points in a block of stateless interpolation.
+	static int getBlock();
+};
+
+} // namespace cpu
+
+#endif // DETERMINISTIC_H
@@ -1,22 +1,59 @@
 #ifndef DEVICE_H
 #define DEVICE_H
 
+#include <vector>
+
 namespace cpu {
 
 class Devices;
 
 class Postprocessor;
 
+class WorkerPool;
+
 // Defines device-specific parameters of interpolator.
+// CPU device is a group of cores of the process affinity mask:
+// a NUMA node, a socket, or a fixed number of cores (see Devices.h).
 class Device
 {
 	int available;
 	
 	Postprocessor* post;
 
+	int id;
+
+	// NUMA node of the device cores (of the first one, if cores
+	// are grouped across nodes).
+	int node;
+
+	// Logical CPUs of the device.
+	std::vector<int> cpus;
+
+	// Number of physical cores.
+	int ncores;
+
+	// Cache sizes in bytes, per level (index 1 for L1 data, 2 for L2,
+	// 3 for L3), 0 if unknown.
+	long cacheSizes[4];
+
+	// Threads pinned to the device CPUs, or NULL, if not enabled.
+	WorkerPool* pool;
+
 public :
 
 	Device();
+
+	int getID() const;
+	
+	int getNode() const;
+
+	const std::vector<int>& getCPUs() const;
+
+	int getCoreCount() const;
+
+	long getCacheSize(int level) const;
+
+	WorkerPool* getWorkerPool() const;
 	
 	friend class Devices;
 };
@@ -24,4 +61,3 @@ public :
 } // namespace cpu
 
 #endif // DEVICE_H
-
@@ -1,18 +1,42 @@
 #ifndef DEVICE_PROPERTIES_H
 #define DEVICE_PROPERTIES_H
 
+#include "Device.h"
 #include "SIMDVector.h"
 
+#include <vector>
+
 namespace cpu {
 
 class DeviceProperties
 {
+	SIMDVector simdVector;
+
+	const Device* device;
+
 public :
 
+	DeviceProperties(const Device* device);
+
 	virtual const SIMDVector* getSIMDVector() const;
+
+	// NUMA node, the device cores belong to.
+	virtual int getNode() const;
+
+	virtual int getCoreCount() const;
+
+	virtual int getThreadCount() const;
+
+	// Size of data cache of the given level (1, 2 or 3) in bytes,
+	// shared by all cores of the device in case of L3.
+	virtual long getCacheSize(int level) const;
+
+	// Instruction set of generic kernels (see ISA.h).
+	virtual const char* getISA() const;
+
+	static std::vector<DeviceProperties*>& getDeviceProperties();
 };
 
 } // namespace cpu
 
 #endif // DEVICE_PROPERTIES_H
-
@@ -5,24 +5,54 @@
 
 #include "Device.h"
 
+// CPU cores available to the process (its affinity mask, as set by MPI
+// launcher or numactl) are split into devices, according to CPU_DEVICES
+// environment variable:
+//
+//   node    - one device per NUMA node (default),
+//   socket  - one device per socket,
+//   single  - all cores in one device,
+//   <n>     - groups of n physical cores, with their SMT siblings.
+//
+// Topology is read from sysfs, if it is not available, all cores form
+// a single device. A device can be held by as many threads at once,
+// as it has logical CPUs: tryAcquire gives out the device of the CPU
+// the calling thread runs on, or, if it is full, any other device
+// with free slots, or, if all are full, the least loaded device,
+// so that it never fails.
+//
+// If CPU_DEVICE_WORKERS is set to n > 0, every device also starts n threads
+// pinned to its CPUs, and stateless interpolation of many points on this
+// device is shared between them and the calling thread (see WorkerPool.h).
+
 namespace cpu {
 
+class DeviceProperties;
+
 class Devices
 {
 	std::vector<Device> devices;
 
+	// Device index of every logical CPU, or -1, if CPU is not in use.
+	std::vector<int> owners;
+
 public :
 
 	Devices();
 
+	~Devices();
+
+	int getCount();
+
 	Device* getDevice(int i);
 
 	Device* tryAcquire();
 
 	void release(Device* device);
+	
+	friend class DeviceProperties;
 };
 
 } // namespace cpu
 
 #endif // DEVICES_H
-
@@ -0,0 +1,50 @@
+#ifndef ISA_H
+#define ISA_H
+
+// Instruction set of CPU kernels. Every kernel is built into the library
+// once per instruction set, and the variant to run is selected once per
+// process, from CPUID. CPU_ISA environment variable (scalar, sse42, avx2
+// or avx512) may lower the selection, e.g. for testing, but never raise it
+// above what the host supports.
+//
+// Generic kernel symbols forward to the selected variant (src/Dispatch.cpp),
+// thus callers are not aware of dispatching.
+
+#include "KernelRegistry.h"
+
+namespace cpu {
+
+class ISA
+{
+public :
+
+	enum Kind
+	{
+		Scalar = 0,
+		SSE42,
+		AVX2,
+		AVX512,
+		Count
+	};
+
+	// Instruction set selected for this process.
+	static Kind get();
+
+	// The best instruction set supported by the host.
+	static Kind getHost();
+
+	static const char* getName(Kind isa);
+
+	// Compiler flags to build a kernel for the given instruction set.
+	static const char* getFlags(Kind isa);
+
+	// Width of vector register of the given instruction set, in bytes.
+	static int getVectorSize(Kind isa);
+
+	// Generic kernel of the given kind, built for the given instruction set.
+	static void* getKernel(KernelKind kind, Kind isa);
+};
+
+} // namespace cpu
+
+#endif // ISA_H
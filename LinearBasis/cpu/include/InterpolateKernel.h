@@ -5,6 +5,9 @@
 #include <process.h>
 #include <string>
 #include <unistd.h>
+#include <vector>
+
+#include "Tracer.h"
 
 namespace cpu {
 
@@ -14,12 +17,24 @@ template<typename T>
 class InterpolateKernel
 {
 	int dim;
+
+	// Rank of the process, set by JIT, as kernels may be loaded
+	// by a background thread, which shall make no MPI calls.
+	int rank;
+
 	bool compilationFailed;
 	T func;
 	static const std::string sh;
+#ifdef HAVE_PRECOMPILED
+	// Lookup of kernel specialization bundled into the library.
+	typedef T (*Lookup)(int dim);
+	static const Lookup precompiled;
+#endif
 	std::string filename;
-	bool fileowner;
 	std::string funcname;
+
+	// Compiled kernel shared object, kept for shipping to other ranks.
+	std::vector<char> image;
 	
 	pthread_mutex_t mutex;
 
@@ -36,6 +51,7 @@ public :
 			if (!func)
 			{
 				string type = "CPU";
+				TRACE_SCOPE("dlopen");
 			
 				// Open compiled library and load interpolation function entry point.
 #ifndef RTLD_DEEPBIND
@@ -59,9 +75,7 @@ public :
 					return func;
 				}
 
-				MPI_Process* process;
-				MPI_ERR_CHECK(MPI_Process_get(&process));
-				cout << "Rank #" << process->getRank() << " loaded " << type << " kernel for dim = " << dim << " : " <<
+				cout << "Rank #" << rank << " loaded " << type << " kernel for dim = " << dim << " : " <<
 					funcname << " @ " << hex << (void*)func << dec << endl;		
 			}
 			PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
@@ -71,7 +85,7 @@ public :
 	}
 
 	InterpolateKernel() :
-		dim(-1), compilationFailed(false), func(NULL), filename(""), fileowner(false)
+		dim(-1), rank(0), compilationFailed(false), func(NULL), filename("")
 	{
 		pthread_mutex_init(&mutex, NULL); 
 	}
@@ -79,26 +93,14 @@ public :
 	InterpolateKernel(const InterpolateKernel& other)
 	{
 		dim = other.dim;
+		rank = other.rank;
 		compilationFailed = other.compilationFailed;
 		func = other.func;
 		filename = other.filename;
-		fileowner = false;
+		funcname = other.funcname;
 		pthread_mutex_init(&mutex, NULL);
 	}
 
-	~InterpolateKernel()
-	{
-		if (fileowner && (filename != ""))
-		{
-			bool keepCache = false;
-			const char* keepCacheValue = getenv("KEEP_CACHE");
-			if (keepCacheValue)
-				keepCache = atoi(keepCacheValue);
-			if (!keepCache)
-				unlink(filename.c_str());
-		}
-	}
-	
 	friend class JIT;
 };
 
@@ -27,9 +27,9 @@ typedef void (*InterpolateArrayFunc)(
 typedef void (*InterpolateArrayManyStatelessFunc)(
 	Device* device,
 	const int dim, const int nno,
-	const int Dof_choice_start, const int Dof_choice_end, const int count, const real* x,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const real* x, const int ldx,
 	const Matrix<int>* index, const Matrix<real>* surplus,
-	real* value);
+	real* value, const int ldvalue);
 
 typedef void (*InterpolateArrayManyMultistateFunc)(
 	Device* device,
@@ -43,20 +43,65 @@ typedef InterpolateKernel<InterpolateArrayFunc> InterpolateArrayKernel;
 typedef InterpolateKernel<InterpolateArrayManyStatelessFunc> InterpolateArrayManyStatelessKernel;
 typedef InterpolateKernel<InterpolateArrayManyMultistateFunc> InterpolateArrayManyMultistateKernel;
 
+// All kernels are specialized for dim and count. Count is the number of
+// states for multistate kernels, which is fixed per data, and always 1 for
+// others: kernel sources do not use it, thus specializing stateless kernels
+// for the number of points would only compile the same code again for
+// every batch size.
 class JIT
 {
+	// Compile kernel by the calling rank alone, or find it in JIT cache.
+	template<typename K>
+	static void compile(K& kernel, int dim, int count, const std::string& funcname);
+
 public :
+	// Set up the ranks topology for kernels distribution.
+	// Must be called collectively by all ranks.
+	static void initialize();
+
+	// Compile kernel synchronously. By default, the calling rank compiles
+	// the kernel alone (or finds it in JIT cache), as other ranks may never
+	// request the same kernel. Collective compilation shall be requested
+	// by all ranks for the same kernels in the same order (as warmup does):
+	// then each kernel is compiled by one rank only, and is shipped to all
+	// other nodes.
 	static InterpolateValueKernel& jitCompile(
-		int dim, const std::string& funcnameTemplate, InterpolateValueFunc fallbackFunc);
+		int dim, int count, const std::string& funcnameTemplate, InterpolateValueFunc fallbackFunc,
+		bool collective = false);
 	static InterpolateArrayKernel& jitCompile(
-		int dim, const std::string& funcnameTemplate, InterpolateArrayFunc fallbackFunc);
+		int dim, int count, const std::string& funcnameTemplate, InterpolateArrayFunc fallbackFunc,
+		bool collective = false);
 	static InterpolateArrayManyStatelessKernel& jitCompile(
-		int dim, int count, const std::string& funcnameTemplate, InterpolateArrayManyStatelessFunc fallbackFunc);
+		int dim, int count, const std::string& funcnameTemplate, InterpolateArrayManyStatelessFunc fallbackFunc,
+		bool collective = false);
 	static InterpolateArrayManyMultistateKernel& jitCompile(
-		int dim, int count, const std::string& funcnameTemplate, InterpolateArrayManyMultistateFunc fallbackFunc);
+		int dim, int count, const std::string& funcnameTemplate, InterpolateArrayManyMultistateFunc fallbackFunc,
+		bool collective = false);
+
+	template<typename K, typename F>
+	static K& jitCompile(int dim, int count, const std::string& funcnameTemplate, F fallbackFunc,
+		bool collective = false);
+
+	// Start kernel compilation in background thread and return immediately.
+	// The target function pointer is set to the fallback function first,
+	// and is atomically replaced with the compiled kernel, once it is loaded.
+	// Only the first call for the given target has effect. Compilation is
+	// never collective. If JIT_ASYNC=0 is set, compile synchronously.
+	static void jitCompileAsync(
+		int dim, int count, const std::string& funcnameTemplate, InterpolateValueFunc fallbackFunc,
+		InterpolateValueFunc* target);
+	static void jitCompileAsync(
+		int dim, int count, const std::string& funcnameTemplate, InterpolateArrayFunc fallbackFunc,
+		InterpolateArrayFunc* target);
+	static void jitCompileAsync(
+		int dim, int count, const std::string& funcnameTemplate, InterpolateArrayManyStatelessFunc fallbackFunc,
+		InterpolateArrayManyStatelessFunc* target);
+	static void jitCompileAsync(
+		int dim, int count, const std::string& funcnameTemplate, InterpolateArrayManyMultistateFunc fallbackFunc,
+		InterpolateArrayManyMultistateFunc* target);
 
 	template<typename K, typename F>
-	static K& jitCompile(int dim, int count, const std::string& funcnameTemplate, F fallbackFunc);
+	static void jitCompileAsync(int dim, int count, const std::string& funcnameTemplate, F fallbackFunc, F* target);
 };
 
 } // namespace cpu
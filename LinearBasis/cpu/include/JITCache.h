@@ -0,0 +1,62 @@
+#ifndef JIT_CACHE_H
+#define JIT_CACHE_H
+
+#ifdef HAVE_RUNTIME_OPTIMIZATION
+
+#include <string>
+
+namespace cpu {
+
+// Persistent on-disk storage of JIT-compiled kernels. Each shared object
+// is named after a hash of everything that affects the generated code:
+// the kernel source, the library it is built for (standing for the headers
+// they share), the compile command, the compiler version and the host ISA.
+// A later run finds an existing kernel under the same name and loads it
+// immediately instead of running the compiler again: the compiler version
+// is queried once per process, and nothing else is run on cache hit.
+//
+// Cache directory defaults to "./.cache" and could be changed with
+// JIT_CACHE_DIR environment variable. The total size of cached kernels
+// is limited to JIT_CACHE_SIZE_MB megabytes (1024 by default): the least
+// recently used kernels are evicted first, along with their lock files,
+// except for those used within the last minute.
+class JITCache
+{
+	std::string dir;
+	size_t maxSize;
+
+	static std::string getCompilerVersion(const std::string& cmd);
+
+	static std::string getHostISA();
+
+	// Hash of the kernel sources of the command and of the library.
+	static std::string getSourceStamp(const std::string& cmd);
+
+	// Evict the least recently used kernels, until the cache
+	// fits into the size limit. The given kernel is never evicted.
+	void trim(const std::string& keep);
+
+	JITCache();
+
+public :
+
+	const std::string& getDirectory() const;
+
+	// Get the shared object filename for the kernel that is built
+	// by the given compile command (with no output file specified).
+	std::string getFilename(const std::string& funcname, const std::string& cmd) const;
+
+	// Ensure the kernel is present in cache, compiling it, if necessary.
+	// Safe to be called concurrently by multiple processes sharing the same
+	// cache directory: only one of them will actually run the compiler.
+	bool compile(const std::string& cmd, const std::string& filename);
+
+	static JITCache& getInstance();
+};
+
+} // namespace cpu
+
+#endif // HAVE_RUNTIME_OPTIMIZATION
+
+#endif // JIT_CACHE_H
+
@@ -0,0 +1,75 @@
+#ifndef KERNEL_REGISTRY_H
+#define KERNEL_REGISTRY_H
+
+#include <cstddef>
+
+namespace cpu {
+
+enum KernelKind
+{
+	InterpolateValueKind = 1,
+	InterpolateArrayKind,
+	InterpolateArrayManyStatelessKind,
+	InterpolateArrayManyMultistateKind
+};
+
+// Runtime-optimized kernels, keyed on all parameters they are specialized for:
+// kernel kind, dim and count (the number of states of multistate kernels).
+// Allows several models of different dims and numbers of states
+// to be used in the same process. Lookup is lock-free:
+// entries are inserted into open-addressing hash table with CAS, and are never
+// removed, so that a pointer to entry remains valid forever.
+class KernelRegistry
+{
+public :
+
+	class Entry
+	{
+		unsigned long long key;
+		void* func;
+
+		friend class KernelRegistry;
+
+	public :
+
+		// Get kernel entry point, or NULL, if kernel is not yet compiled.
+		template<typename F>
+		inline __attribute__((always_inline)) F getFunc() const
+		{
+			return (F)__atomic_load_n(&func, __ATOMIC_ACQUIRE);
+		}
+
+		// Get kernel entry point location, to be updated by compiler.
+		template<typename F>
+		inline __attribute__((always_inline)) F* getTarget()
+		{
+			return (F*)&func;
+		}
+	};
+
+private :
+
+	static const int capacity = 1024;
+
+	Entry entries[capacity];
+
+public :
+
+	static unsigned long long getKey(KernelKind kind, int dim, int count);
+
+	// Find entry for the given key, inserting it, if not found.
+	// Returns NULL, if registry is full.
+	Entry* get(unsigned long long key);
+
+	inline __attribute__((always_inline)) Entry* get(KernelKind kind, int dim, int count)
+	{
+		return get(getKey(kind, dim, count));
+	}
+
+	static KernelRegistry& getInstance();
+};
+
+} // namespace cpu
+
+#endif // KERNEL_REGISTRY_H
+
@@ -0,0 +1,44 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+// Storage of large vectors and matrices (of at least one 2 MB page),
+// mapped directly with mmap, so that TLB reach covers multi-GB surplus.
+// HUGEPAGES environment variable selects the pages:
+//
+//   thp  - transparent huge pages, requested with madvise (default),
+//   2M   - explicit 2 MB pages (MAP_HUGETLB), from vm.nr_hugepages pool,
+//   1G   - explicit 1 GB pages, from the pool of 1 GB pages,
+//   none - regular pages.
+//
+// If the pool of explicit huge pages is exhausted, transparent huge pages
+// are used instead. If DATA_MLOCK is set, storage is locked in memory
+// (subject to RLIMIT_MEMLOCK), so that it is never swapped out or
+// compacted. If DATA_PREFAULT is set, all pages are faulted in by the
+// kernel in a single pass at allocation, rather than one by one, when
+// storage is zero-filled. Smaller allocations use posix_memalign.
+
+#include <cstddef>
+
+namespace cpu {
+
+class Memory
+{
+public :
+
+	// Allocate zeroed storage of the given size, aligned at least by the
+	// given number of bytes, or return NULL, if size is below threshold.
+	static void* allocate(size_t size, size_t alignment);
+
+	// Free storage of the given size, if it was allocated by allocate,
+	// and return true, or return false otherwise.
+	static bool deallocate(void* ptr, size_t size);
+
+	// Size of the pages backing the given address: the explicit huge page
+	// size within storage mapped with MAP_HUGETLB, the regular page size
+	// otherwise (transparent huge pages are split by the kernel as needed).
+	static size_t getPageSize(const void* ptr);
+};
+
+} // namespace cpu
+
+#endif // MEMORY_H
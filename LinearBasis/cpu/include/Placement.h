@@ -0,0 +1,72 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+// Placement of index and surplus matrices over NUMA nodes. Policy is set
+// per Data with Data::setPlacement, or for all Data with DATA_PLACEMENT
+// environment variable:
+//
+//   local      - pages stay, where the loading thread touched them (default),
+//   interleave - pages are spread round-robin over all nodes with memory,
+//   partition  - rows are split evenly between devices (see Devices.h), and
+//                each part is moved to the node of its device,
+//   replicate  - every node with memory gets its own copy, and kernels read
+//                the copy of the device node (or of the calling thread node,
+//                if device is not given).
+//
+// Replication multiplies memory footprint by the number of nodes and load
+// time by the cost of copying, and pays back only for read-mostly data with
+// kernels running on several nodes. Pages are moved with mbind system call,
+// thus no libnuma is needed; on a single node, or if the kernel refuses
+// to move pages, data is left in place, as are states used in place
+// (adopted arrays of the caller and shared memory), unless replicated.
+
+#include <cstddef>
+#include <vector>
+
+namespace cpu {
+
+class Data;
+
+class Placement
+{
+public :
+
+	enum Policy
+	{
+		Local = 0,
+		Interleave,
+		Partition,
+		Replicate,
+		Count
+	};
+
+	// Policy given by DATA_PLACEMENT, or Local.
+	static Policy getDefault();
+
+	static const char* getName(Policy policy);
+
+	// NUMA nodes with memory.
+	static const std::vector<int>& getNodes();
+
+	// NUMA node of the CPU, the calling thread runs on.
+	static int getCurrentNode();
+
+	// Spread pages of the buffer over all nodes with memory.
+	static bool interleave(void* ptr, size_t size);
+
+	// Move pages of the buffer to the given node.
+	static bool bind(void* ptr, size_t size, int node);
+
+	// Add up bytes of the buffer resident on each node, indexed by node.
+	static void query(const void* ptr, size_t size, std::vector<long>& bytes);
+
+	static Policy getPolicy(const Data* data);
+
+	// Get policy of data, and bytes of its matrices (replicas included)
+	// resident on each node, indexed by node.
+	static Policy getPlacement(const Data* data, std::vector<long>& bytes);
+};
+
+} // namespace cpu
+
+#endif // PLACEMENT_H
@@ -0,0 +1,62 @@
+#ifndef PRECOMPILED_H
+#define PRECOMPILED_H
+
+// Included at the end of kernel source, when it is built with PRECOMPILED
+// defined to the name of lookup function. At this point FUNCNAME is a kernel
+// template on DIM. Instantiate it for every dim in [1, PRECOMPILED_DIM_MAX],
+// and provide a constant-time lookup of instance by dim. Lookup returns NULL
+// for dims out of range, which are then left to runtime optimization.
+
+#include <cstddef>
+
+#ifndef PRECOMPILED_DIM_MAX
+#define PRECOMPILED_DIM_MAX 128
+#endif
+
+namespace {
+
+typedef decltype(&FUNCNAME<1>) PrecompiledFunc;
+
+template<int D>
+struct PrecompiledTable
+{
+	static void fill(PrecompiledFunc* table)
+	{
+		table[D] = &FUNCNAME<D>;
+		PrecompiledTable<D - 1>::fill(table);
+	}
+};
+
+template<>
+struct PrecompiledTable<0>
+{
+	static void fill(PrecompiledFunc* table)
+	{
+		table[0] = NULL;
+	}
+};
+
+struct PrecompiledFuncs
+{
+	PrecompiledFunc table[PRECOMPILED_DIM_MAX + 1];
+
+	PrecompiledFuncs()
+	{
+		PrecompiledTable<PRECOMPILED_DIM_MAX>::fill(table);
+	}
+};
+
+const PrecompiledFuncs precompiledFuncs;
+
+} // namespace
+
+extern "C" PrecompiledFunc PRECOMPILED(int dim)
+{
+	if ((dim < 1) || (dim > PRECOMPILED_DIM_MAX))
+		return NULL;
+
+	return precompiledFuncs.table[dim];
+}
+
+#endif // PRECOMPILED_H
+
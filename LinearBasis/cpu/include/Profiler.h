@@ -0,0 +1,122 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// Roofline profiling of interpolation calls. Enabled by setting PROFILE
+// environment variable: each call is measured with hardware counters of
+// the calling thread (cycles, instructions, last level cache misses),
+// opened with perf_event_open, and accounted together with its analytic
+// FLOP and byte counts. At MPI_Finalize master prints per-kernel roofline
+// summary over all ranks.
+//
+// Per-thread counters cannot see memory controllers, thus DRAM traffic
+// is estimated as LLC misses times cache line size. If perf counters are
+// restricted (see /proc/sys/kernel/perf_event_paranoid) or not supported,
+// only time and analytic counts are reported.
+//
+// Roofs are calibrated once with single-threaded FMA and streaming loops,
+// unless given with PROFILE_PEAK_GFLOPS and PROFILE_PEAK_GBS.
+
+#include "Counters.h"
+
+namespace cpu {
+
+class Profiler
+{
+public :
+
+	enum Event
+	{
+		EventCycles = 0,
+		EventInstructions,
+		EventCacheMisses,
+		EventCount
+	};
+
+	struct Thread
+	{
+		// Counter group of this thread, -1 if not available, and position
+		// of every event in the group, -1 if event is not supported.
+		int fd;
+		int slots[EventCount];
+
+		unsigned long long calls[CounterKindCount];
+		unsigned long long nanoseconds[CounterKindCount];
+		double flops[CounterKindCount];
+		double bytes[CounterKindCount];
+
+		// Events, and number of calls they were measured for.
+		unsigned long long events[CounterKindCount][EventCount];
+		unsigned long long eventCalls[CounterKindCount][EventCount];
+
+		int id;
+		Thread* next;
+	};
+
+	// True, if enabled, and not suspended in the calling thread.
+	static bool isEnabled();
+
+	// Suspend (or resume) profiling of calls of the calling thread,
+	// e.g. of those made by autotuning.
+	static void suspend(bool suspend);
+
+	// Get counters of the calling thread, opening them on first use.
+	static Thread& getThread();
+
+	// Register summary to happen at MPI_Finalize.
+	static void initialize();
+
+	// Read current values of counters of the given thread
+	// (zeros for events not supported).
+	static void readEvents(Thread& thread, unsigned long long* values);
+
+	// Analytic upper bounds for count points of dim dimensions over nno
+	// rows, ndofs values each, assuming no row is rejected by early exit:
+	// per dimension of row, basis costs a multiply, two subtractions and
+	// the product update; per value, a multiply-add. Index and surplus rows
+	// are streamed once per point.
+	static inline double getFlops(int dim, int nno, int ndofs, int count)
+	{
+		return (double)count * nno * (4.0 * dim + 2.0 * ndofs);
+	}
+
+	static inline double getBytes(int dim, int nno, int ndofs, int count)
+	{
+		int vdim = (dim + AVX_VECTOR_SIZE - 1) / AVX_VECTOR_SIZE * AVX_VECTOR_SIZE;
+		return (double)count * nno * (2.0 * vdim * sizeof(int) + ndofs * sizeof(double));
+	}
+
+	// Measure a call from construction to destruction.
+	class Scope
+	{
+		Thread* thread;
+		CounterKind kind;
+		int dim, nno, ndofs, count;
+		long long begin;
+		unsigned long long values[EventCount];
+
+		void start();
+		void stop();
+
+	public :
+
+		inline __attribute__((always_inline)) Scope(CounterKind kind_, int dim_, int nno_, int ndofs_, int count_) :
+			thread(NULL), kind(kind_), dim(dim_), nno(nno_), ndofs(ndofs_), count(count_)
+		{
+			if (!isEnabled()) return;
+
+			start();
+		}
+
+		inline __attribute__((always_inline)) ~Scope()
+		{
+			if (thread) stop();
+		}
+	};
+};
+
+} // namespace cpu
+
+#define PROFILE_SCOPE(kind, dim, nno, ndofs, count) \
+	cpu::Profiler::Scope profile_scope(kind, dim, nno, ndofs, count)
+
+#endif // PROFILER_H
@@ -0,0 +1,65 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+// Record of interpolation calls, to be re-executed offline with the replay
+// tool of benchmark. Enabled by setting RECORD environment variable to the
+// output prefix: each rank writes its calls into RECORD.<rank>.bin.
+//
+// Each thread appends calls into its own buffer of RECORD_BUFFER bytes
+// (1 MiB by default), with no locks on the way. Only a full buffer is
+// written out, under a lock, and the rest at MPI_Finalize.
+//
+// File starts with Recorder::Header, followed by calls: each is
+// Recorder::Call followed by count * dim values of x (for multistate
+// call, dim values of x per state, in order of states).
+
+namespace cpu {
+
+class Recorder
+{
+public :
+
+	struct Header
+	{
+		char magic[8];		// "hddmrec"
+		int version;
+		int realSize;		// sizeof(real)
+	};
+
+	struct Call
+	{
+		unsigned char kind;	// KernelKind
+		unsigned char reserved;
+		unsigned short thread;	// recording thread, in order of first call
+		int dim;
+		int istate;		// -1 for multistate call
+		int Dof_choice_start;
+		int Dof_choice_end;
+		int count;		// number of states for multistate call
+		long long time;		// monotonic time of call in nanoseconds
+	};
+
+	// True, if enabled, and not suspended in the calling thread.
+	static bool isEnabled();
+
+	// Suspend (or resume) recording of calls of the calling thread,
+	// e.g. of those made by autotuning.
+	static void suspend(bool suspend);
+
+	// Open output file and register flush to happen at MPI_Finalize.
+	static void initialize();
+
+	// Record call with count points of dim values of x, apart by ldx
+	// (dim, if 0).
+	static void record(int kind, int dim, int istate,
+		int Dof_choice_start, int Dof_choice_end, int count, const real* x, int ldx = 0);
+
+	// Record multistate call, with dim values of x per state.
+	static void record(int kind, int dim,
+		int Dof_choice_start, int Dof_choice_end, int nstates, const real* const* x);
+};
+
+} // namespace cpu
+
+#endif // RECORDER_H
+
@@ -2,6 +2,7 @@
 #define SIMDVECTOR_H
 
 #include "check.h"
+#include "ISA.h"
 #include "process.h"
 
 #include <iostream>
@@ -14,23 +15,18 @@ public :
 
 	virtual inline __attribute__((always_inline)) size_t getLength(size_t szelement) const
 	{
-#ifdef HAVE_AVX
-		switch (szelement)
+		// Register width of the instruction set kernels are dispatched to.
+		size_t size = ISA::getVectorSize(ISA::get());
+		if ((szelement != 4) && (szelement != 8))
 		{
-		case 4 : return 8;
-		case 8 : return 4;
-		default :
-			{
-				MPI_Process* process;
-				MPI_ERR_CHECK(MPI_Process_get(&process));
-				std::cerr << "Unsupported vector element size = " << szelement << std::endl;
-				process->abort();
-			}
+			MPI_Process* process;
+			MPI_ERR_CHECK(MPI_Process_get(&process));
+			std::cerr << "Unsupported vector element size = " << szelement << std::endl;
+			process->abort();
 		}
-// #elif TODO: implement SSE, AVX512, etc. here
-#else
-		return 1;
-#endif
+		if (ISA::get() == ISA::Scalar)
+			return 1;
+		return size / szelement;
 	}
 };
 
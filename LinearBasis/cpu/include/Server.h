@@ -0,0 +1,103 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+// Local interpolation server: a process loads Data once and serves
+// interpolation requests of other processes on the same node, which then
+// need no private copy of surplus.
+//
+// Requests are passed through a ring of slots in shared memory, common to
+// all clients: client claims a free slot, writes up to SERVER_POINTS points
+// into it (16 by default; larger requests take several slots), and wakes
+// the server with a futex. Server takes all submitted slots at once, merges
+// those for the same state and Dof range from all clients into one
+// stateless interpolation of many points, writes results back into the
+// slots, and wakes the clients. SERVER_SLOTS sets the number of slots
+// (256 by default). A client, which finds the ring full, frees the finished
+// slots of its request before claiming more, thus a request of any size
+// proceeds, as do concurrent requests, which fill the ring together.
+//
+// Unix domain socket is used for control: on connection the server sends
+// the ring descriptor (SCM_RIGHTS), and the parameters of data; a client
+// may also send "stop" to shut the server down. Slots are marked with the
+// client process holding them, and once all connections of a process are
+// closed, e.g. as it has crashed in the middle of a request, the server
+// frees its slots. Client API is exported
+// with C linkage, mirroring Interpolator::interpolate for many points
+// (see the end of src/Server.cpp).
+
+#include <string>
+#include <vector>
+
+namespace cpu {
+
+class Data;
+
+template<typename T>
+class Vector;
+
+class Server
+{
+public :
+
+	struct Ring;
+
+private :
+
+	const Data* data;
+	std::string path;
+
+	// Shared memory of the ring, and the control socket.
+	int fd, listener;
+	Ring* ring;
+	size_t size;
+
+	int stopped;
+
+	static void* control(void* server);
+
+	// Take submitted slots, and interpolate them, return false,
+	// if there are none.
+	bool serve(Vector<real>& x, Vector<real>& value);
+
+public :
+
+	Server(const Data* data, const char* path);
+
+	~Server();
+
+	// Serve requests, until a client sends "stop".
+	void run();
+};
+
+class Client
+{
+	int socket;
+	Server::Ring* ring;
+	size_t size;
+
+	Client(int socket, Server::Ring* ring, size_t size);
+
+public :
+
+	// Connect to server listening on the given socket path,
+	// or return NULL, if there is none.
+	static Client* connect(const char* path);
+
+	~Client();
+
+	// Interpolate count points, returns false, if request is rejected
+	// by server (e.g. state is not loaded).
+	bool interpolate(const int istate, const real* x,
+		const int Dof_choice_start, const int Dof_choice_end, const int count, real* value);
+
+	int getDim() const;
+
+	int getTotalDof() const;
+
+	// Ask server to stop.
+	void stop();
+};
+
+} // namespace cpu
+
+#endif // SERVER_H
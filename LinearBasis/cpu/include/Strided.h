@@ -0,0 +1,28 @@
+#ifndef STRIDED_H
+#define STRIDED_H
+
+// Stateless interpolation of many points, read from and written into
+// arrays with leading dimensions of the caller, with any alignment.
+// Specific to the CPU backend, thus not a part of Interpolator interface
+// shared by all backends. The solver reaches it through interpolateStrided
+// export.
+
+namespace cpu {
+
+class Data;
+class Device;
+
+class Strided
+{
+public :
+
+	// Interpolate multiple arrays of values, with single surplus state, reading points
+	// and writing values apart by the given leading dimensions.
+	static void interpolate(Device* device, const Data* data,
+		const int istate, const real* x, const int ldx, const int Dof_choice_start, const int Dof_choice_end,
+		const int count, real* value, const int ldvalue);
+};
+
+} // namespace cpu
+
+#endif // STRIDED_H
@@ -0,0 +1,99 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+// Timeline of load, JIT and kernel phases in Chrome trace-event format,
+// to be opened with chrome://tracing or Perfetto. Enabled by setting TRACE
+// environment variable to the output prefix: each rank writes its events
+// into TRACE.<rank>.json at MPI_Finalize.
+//
+// Each thread records events into its own ring buffer of TRACE_EVENTS
+// events (65536 by default), with no locks and no allocations on the way.
+// If the ring overflows, the oldest events are overwritten.
+
+#include <time.h>
+
+namespace cpu {
+
+class Tracer
+{
+public :
+
+	struct Event
+	{
+		const char* name;
+		long long begin;
+		long long end;
+	};
+
+	struct Thread
+	{
+		Event* events;
+		unsigned long long capacity;
+		unsigned long long count;
+
+		int id;
+		Thread* next;
+	};
+
+	static bool isEnabled();
+
+	// Get ring buffer of the calling thread, registering it on first use.
+	static Thread& getThread();
+
+	// Register output to happen at MPI_Finalize.
+	static void initialize();
+
+	// Monotonic time in nanoseconds.
+	static inline __attribute__((always_inline)) long long now()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	}
+
+	// Record completed event. Name must be a string literal,
+	// as only the pointer is kept.
+	static inline __attribute__((always_inline)) void record(const char* name, long long begin, long long end)
+	{
+		Thread& thread = getThread();
+		Event& event = thread.events[thread.count & (thread.capacity - 1)];
+		event.name = name;
+		event.begin = begin;
+		event.end = end;
+		__atomic_store_n(&thread.count, thread.count + 1, __ATOMIC_RELEASE);
+	}
+
+	// Record event from construction to destruction, or to explicit end().
+	class Scope
+	{
+		const char* name;
+		long long begin;
+
+	public :
+
+		inline __attribute__((always_inline)) Scope(const char* name_) : name(NULL), begin(0)
+		{
+			if (!isEnabled()) return;
+
+			name = name_;
+			begin = now();
+		}
+
+		inline __attribute__((always_inline)) void end()
+		{
+			if (!name) return;
+
+			record(name, begin, now());
+			name = NULL;
+		}
+
+		inline __attribute__((always_inline)) ~Scope() { end(); }
+	};
+};
+
+} // namespace cpu
+
+#define TRACE_SCOPE(name) cpu::Tracer::Scope trace_scope(name)
+
+#endif // TRACER_H
+
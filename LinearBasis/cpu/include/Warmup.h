@@ -0,0 +1,26 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+// Preparation of kernels in advance, specific to the CPU backend, thus
+// not a part of Interpolator interface shared by all backends. The solver
+// reaches it through warmupInterpolator export.
+
+namespace cpu {
+
+class Data;
+class Device;
+
+class Warmup
+{
+public :
+
+	// Prepare all kernels for the given data in advance, so that the first
+	// interpolation calls do not pay for compilation, loading and page faults.
+	// Stateless interpolation is run on count points, the largest batch
+	// expected, so that its buffers are touched as well.
+	static void run(Device* device, const Data* data, const int count = 1);
+};
+
+} // namespace cpu
+
+#endif // WARMUP_H
@@ -0,0 +1,54 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+#include <vector>
+
+namespace cpu {
+
+// Threads pinned to the CPUs of a device, to run chunks of a single job
+// together with the calling thread. One job runs at a time: if the pool
+// is busy with the job of another thread, the caller runs all chunks
+// by itself, rather than waiting.
+class WorkerPool
+{
+	std::vector<pthread_t> threads;
+	std::vector<int> cpus;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t wake, done;
+
+	// Held by the thread, whose job is running.
+	pthread_mutex_t busy;
+
+	void (*func)(void* arg, int chunk);
+	void* arg;
+	int nchunks;
+
+	// Index of the next chunk to take.
+	int next;
+
+	// Number of workers running the current job.
+	int active;
+
+	unsigned int generation;
+	bool stop;
+
+	static void* worker(void* pool);
+
+public :
+
+	WorkerPool(const std::vector<int>& cpus, int nworkers);
+
+	~WorkerPool();
+
+	// Number of threads sharing the job, including the caller.
+	int getSize() const;
+
+	// Run func for every chunk in [0, nchunks), return once all are done.
+	void run(int nchunks, void (*func)(void* arg, int chunk), void* arg);
+};
+
+} // namespace cpu
+
+#endif // WORKER_POOL_H
@@ -0,0 +1,151 @@
+#include "Arena.h"
+#include "check.h"
+#include "Counters.h"
+#include "Memory.h"
+#include "process.h"
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace cpu;
+using namespace std;
+
+// Arenas of all threads ever used, never freed, as of counters.
+static Arena* arenas = NULL;
+
+static __thread Arena* arena = NULL;
+
+static size_t getInitialSize()
+{
+	static long size = -1;
+	if (size != -1) return size;
+
+	size = 256;
+	const char* sizeValue = getenv("SCRATCH_SIZE");
+	if (sizeValue)
+		size = max(0, atoi(sizeValue));
+	size *= 1024;
+
+	return size;
+}
+
+static void* allocateBlock(size_t size, size_t alignment)
+{
+	void* ptr = Memory::allocate(size, alignment);
+	if (ptr) return ptr;
+
+	int err = posix_memalign(&ptr, alignment, size);
+	if (err != 0)
+	{
+		cerr << "Cannot allocate " << size << " bytes of scratch memory, posix_memalign returned error " << err << endl;
+		MPI_Process* process;
+		MPI_ERR_CHECK(MPI_Process_get(&process));
+		process->abort();
+	}
+
+	return ptr;
+}
+
+static void freeBlock(void* ptr, size_t size)
+{
+	if (!Memory::deallocate(ptr, size))
+		free(ptr);
+}
+
+Arena::Arena() : base(NULL), size(getInitialSize()), offset(0), used(0), highWater(0), depth(0)
+{
+	if (size)
+		base = (char*)allocateBlock(size, 64);
+}
+
+Arena& Arena::get()
+{
+	if (arena) return *arena;
+
+	arena = new Arena();
+
+	// Lock-free push into the list of all arenas.
+	do arena->next = arenas;
+	while (!__sync_bool_compare_and_swap(&arenas, arena->next, arena));
+
+	return *arena;
+}
+
+void* Arena::allocate(size_t size, size_t alignment)
+{
+	void* ptr;
+	size_t start = (offset + alignment - 1) & ~(alignment - 1);
+	if (start + size <= this->size)
+	{
+		ptr = base + start;
+		used += start + size - offset;
+		offset = start + size;
+	}
+	else
+	{
+		// Excess is taken from heap, until the arena is enlarged.
+		size_t length = (size + alignment - 1) & ~(alignment - 1);
+		ptr = allocateBlock(length, alignment);
+		overflow.push_back(make_pair(ptr, length));
+		used += length;
+	}
+
+	if (used > highWater)
+	{
+		highWater = used;
+#ifdef HAVE_COUNTERS
+		Counters::Thread& thread = Counters::getThread();
+		if (highWater > thread.scratchHighWater)
+			thread.scratchHighWater = highWater;
+#endif
+	}
+
+	return ptr;
+}
+
+void Arena::rewind(size_t offset_, size_t used_)
+{
+	offset = offset_;
+	used = used_;
+
+	// Overflow blocks are kept till the outermost scope ends, then
+	// the arena is enlarged to hold them all next time.
+	if (depth || overflow.empty()) return;
+
+	for (int i = 0; i < (int)overflow.size(); i++)
+		freeBlock(overflow[i].first, overflow[i].second);
+	overflow.clear();
+
+	if (base)
+		freeBlock(base, size);
+	size = (highWater + 4095) & ~(size_t)4095;
+	base = (char*)allocateBlock(size, 64);
+}
+
+size_t Arena::getHighWater() const { return highWater; }
+
+size_t Arena::getMaxHighWater()
+{
+	size_t result = 0;
+	for (const Arena* a = arenas; a; a = a->next)
+		result = max(result, a->getHighWater());
+	return result;
+}
+
+Arena::Scope::Scope(Arena& arena_) : arena(arena_), offset(arena_.offset), used(arena_.used)
+{
+	arena.depth++;
+}
+
+Arena::Scope::~Scope()
+{
+	arena.depth--;
+	arena.rewind(offset, used);
+}
+
+// Get the largest size of scratch memory used at once by any thread,
+// in bytes, for the solver to set SCRATCH_SIZE of later runs.
+extern "C" size_t getScratchHighWater()
+{
+	return Arena::getMaxHighWater();
+}
@@ -0,0 +1,195 @@
+#include "Async.h"
+#include "check.h"
+#include "interpolator.h"
+#include "Tracer.h"
+
+#include <cstdlib>
+#include <cstring>
+
+using namespace cpu;
+using namespace std;
+
+Async::Async() : maxBatch(256)
+{
+	PTHREAD_ERR_CHECK(pthread_mutex_init(&mutex, NULL));
+	PTHREAD_ERR_CHECK(pthread_cond_init(&wake, NULL));
+	PTHREAD_ERR_CHECK(pthread_cond_init(&completed, NULL));
+
+	const char* maxBatchValue = getenv("ASYNC_BATCH");
+	if (maxBatchValue)
+		maxBatch = max(1, atoi(maxBatchValue));
+
+	int nworkers = 1;
+	const char* nworkersValue = getenv("ASYNC_WORKERS");
+	if (nworkersValue)
+		nworkers = max(1, atoi(nworkersValue));
+
+	pthread_attr_t attr;
+	PTHREAD_ERR_CHECK(pthread_attr_init(&attr));
+	PTHREAD_ERR_CHECK(pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED));
+	threads.resize(nworkers);
+	for (int i = 0; i < nworkers; i++)
+		PTHREAD_ERR_CHECK(pthread_create(&threads[i], &attr, &Async::worker, this));
+	PTHREAD_ERR_CHECK(pthread_attr_destroy(&attr));
+}
+
+Async& Async::getInstance()
+{
+	// Workers are never stopped, thus the instance is never destroyed.
+	static Async* async = new Async();
+	return *async;
+}
+
+void Async::process(const vector<Request*>& batch, Vector<real>& x, Vector<real>& value)
+{
+	TRACE_SCOPE("Async::process");
+
+	Interpolator* interp = Interpolator::getInstance();
+	const Request* first = batch[0];
+	const Data* data = first->data;
+
+	if (batch.size() == 1)
+	{
+		interp->interpolate(first->device, data, first->istate, first->x,
+			first->Dof_choice_start, first->Dof_choice_end, first->count, first->value);
+		return;
+	}
+
+	const int TotalDof = first->Dof_choice_end - first->Dof_choice_start + 1;
+
+	int count = 0;
+	for (int i = 0; i < (int)batch.size(); i++)
+		count += batch[i]->count;
+	if (x.length() < count * data->dim)
+		x.resize(count * data->dim);
+	if (value.length() < count * TotalDof)
+		value.resize(count * TotalDof);
+
+	for (int i = 0, offset = 0; i < (int)batch.size(); offset += batch[i]->count, i++)
+		memcpy(x.getData() + offset * data->dim, batch[i]->x, sizeof(real) * batch[i]->count * data->dim);
+
+	interp->interpolate(first->device, data, first->istate, x.getData(),
+		first->Dof_choice_start, first->Dof_choice_end, count, value.getData());
+
+	for (int i = 0, offset = 0; i < (int)batch.size(); offset += batch[i]->count, i++)
+		memcpy(batch[i]->value, value.getData() + offset * TotalDof, sizeof(real) * batch[i]->count * TotalDof);
+}
+
+void* Async::worker(void* async_)
+{
+	Async* async = (Async*)async_;
+
+	vector<Request*> batch;
+	Vector<real> x, value;
+
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&async->mutex));
+	while (1)
+	{
+		while (async->queue.empty())
+			PTHREAD_ERR_CHECK(pthread_cond_wait(&async->wake, &async->mutex));
+
+		// Take requests, which could be merged with the oldest one, as long
+		// as they fit into the batch; the oldest one is always taken, even if
+		// it alone exceeds the batch.
+		batch.clear();
+		const Request* first = async->queue.front();
+		int count = 0;
+		for (deque<Request*>::iterator i = async->queue.begin(); i != async->queue.end(); )
+		{
+			Request* r = *i;
+			if ((r->device == first->device) && (r->data == first->data) && (r->istate == first->istate) &&
+				(r->Dof_choice_start == first->Dof_choice_start) && (r->Dof_choice_end == first->Dof_choice_end))
+			{
+				if (count && (count + r->count > async->maxBatch)) break;
+
+				batch.push_back(r);
+				count += r->count;
+				i = async->queue.erase(i);
+			}
+			else
+				i++;
+		}
+		PTHREAD_ERR_CHECK(pthread_mutex_unlock(&async->mutex));
+
+		async->process(batch, x, value);
+
+		for (int i = 0; i < (int)batch.size(); i++)
+			if (batch[i]->callback)
+				batch[i]->callback(batch[i]->arg);
+
+		PTHREAD_ERR_CHECK(pthread_mutex_lock(&async->mutex));
+		for (int i = 0; i < (int)batch.size(); i++)
+			__atomic_store_n(&batch[i]->done, 1, __ATOMIC_RELEASE);
+		PTHREAD_ERR_CHECK(pthread_cond_broadcast(&async->completed));
+	}
+
+	return NULL;
+}
+
+Async::Request* Async::submit(Device* device, const Data* data, const int istate, const real* x,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, real* value,
+	void (*callback)(void* arg), void* arg)
+{
+	Request* request = new Request();
+	request->device = device;
+	request->data = data;
+	request->istate = istate;
+	request->Dof_choice_start = Dof_choice_start;
+	request->Dof_choice_end = Dof_choice_end;
+	request->count = count;
+	request->x = x;
+	request->value = value;
+	request->callback = callback;
+	request->arg = arg;
+	request->done = 0;
+
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+	queue.push_back(request);
+	PTHREAD_ERR_CHECK(pthread_cond_signal(&wake));
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+
+	return request;
+}
+
+bool Async::test(Request* request)
+{
+	return __atomic_load_n(&request->done, __ATOMIC_ACQUIRE);
+}
+
+void Async::wait(Request* request)
+{
+	if (!test(request))
+	{
+		TRACE_SCOPE("Async::wait");
+
+		PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+		while (!request->done)
+			PTHREAD_ERR_CHECK(pthread_cond_wait(&completed, &mutex));
+		PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+	}
+
+	delete request;
+}
+
+// Queue interpolation of count points in x, in the same layout, as for
+// stateless interpolation of many points, and return request to be passed
+// to waitInterpolation. Callback, if not NULL, is called with arg once
+// results are in value.
+extern "C" Async::Request* submitInterpolation(Device* device, const Data* data, int istate, const real* x,
+	int Dof_choice_start, int Dof_choice_end, int count, real* value, void (*callback)(void* arg), void* arg)
+{
+	return Async::getInstance().submit(device, data, istate, x,
+		Dof_choice_start, Dof_choice_end, count, value, callback, arg);
+}
+
+// Check, if results of request are ready, without releasing it.
+extern "C" bool testInterpolation(Async::Request* request)
+{
+	return Async::getInstance().test(request);
+}
+
+// Wait for results of request, and release it.
+extern "C" void waitInterpolation(Async::Request* request)
+{
+	Async::getInstance().wait(request);
+}
@@ -0,0 +1,288 @@
+#include "Autotuner.h"
+#include "check.h"
+#include "Data.h"
+#include "Deterministic.h"
+#include "interpolator.h"
+#include "ISA.h"
+#include "process.h"
+#include "Profiler.h"
+#include "Recorder.h"
+#include "Tracer.h"
+#include "Warmup.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mpi.h>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace cpu;
+using namespace std;
+
+bool Autotuner::isEnabled()
+{
+	static int enabled = -1;
+	if (enabled != -1) return enabled;
+
+	// Choice by timing is not reproducible.
+	enabled = (getenv("AUTOTUNE") != NULL) && !Deterministic::isEnabled();
+	return enabled;
+}
+
+// 64-bit FNV-1a hash.
+static void fnv1a(unsigned long long& h, const void* data, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		h ^= ((const unsigned char*)data)[i];
+		h *= 1099511628211ULL;
+	}
+}
+
+// Same directory as of JIT cache.
+static string getDirectory()
+{
+	string dir;
+	const char* dirValue = getenv("JIT_CACHE_DIR");
+	if (dirValue)
+		dir = dirValue;
+	else
+	{
+		char* cwd = get_current_dir_name();
+		dir = (string)cwd + "/.cache";
+		free(cwd);
+	}
+
+	mkdir(dir.c_str(), S_IRWXU);
+	return dir;
+}
+
+// Sample of points near grid nodes: each point is drawn within the support
+// of a random row of index, so that interpolation visits as many rows as it
+// does in the real use. Sequence is the same on all ranks.
+static void getSample(const Matrix<int>& index, int dim, int nno, int npoints, int stride, real* x)
+{
+	int vdim = dim / AVX_VECTOR_SIZE;
+	if (dim % AVX_VECTOR_SIZE) vdim++;
+	vdim *= AVX_VECTOR_SIZE;
+
+	unsigned long long seed = 1;
+	for (int p = 0; p < npoints; p++)
+	{
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		int row = (seed >> 33) % nno;
+		for (int i = 0; i < dim; i++)
+		{
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			double u = (double)(seed >> 11) / (double)(1ULL << 53);
+
+			int l = index(row, i), j = index(row, i + vdim);
+			double value = l ? (j + u - 0.5) / l : u;
+			x[p * stride + i] = min(1.0, max(0.0, value));
+		}
+	}
+}
+
+void Autotuner::tune(Data* data)
+{
+	TRACE_SCOPE("Autotuner::tune");
+
+	MPI_Process* process;
+	MPI_ERR_CHECK(MPI_Process_get(&process));
+
+	if (find(data->loadedStates.begin(), data->loadedStates.end(), false) != data->loadedStates.end())
+	{
+		cerr << "Autotuning requires all states of data to be loaded" << endl;
+		process->abort();
+	}
+
+	Interpolator* interp = Interpolator::getInstance();
+	const bool jit = interp->getParameters().enableRuntimeOptimization;
+
+	int npoints = 16;
+	const char* npointsValue = getenv("AUTOTUNE_POINTS");
+	if (npointsValue)
+		npoints = max(1, atoi(npointsValue));
+
+	int nrepeats = 3;
+	const char* nrepeatsValue = getenv("AUTOTUNE_REPEAT");
+	if (nrepeatsValue)
+		nrepeats = max(1, atoi(nrepeatsValue));
+
+	// Instruction sets supported by all ranks.
+	int isaMax = ISA::get();
+	MPI_ERR_CHECK(MPI_Allreduce(MPI_IN_PLACE, &isaMax, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD));
+
+	// Tuning depends on the shape of data, its contents (sampled rows),
+	// the candidates and the number of ranks.
+	unsigned long long h = 14695981039346656037ULL;
+	int params[] = { data->dim, data->nno, data->TotalDof, data->nstates,
+		isaMax, jit, npoints, process->getSize() };
+	fnv1a(h, params, sizeof(params));
+	for (int istate = 0; istate < data->nstates; istate++)
+		for (int i = 0, step = max(1, data->nno / 64); i < data->nno; i += step)
+		{
+			fnv1a(h, &data->index[istate](i, 0), sizeof(int) * data->dim);
+			fnv1a(h, &data->surplus[istate](i, 0), sizeof(real) * data->TotalDof);
+		}
+	stringstream sfilename;
+	sfilename << getDirectory() << "/autotune_" << data->dim << "_" << hex << h << ".txt";
+	string filename = sfilename.str();
+
+	// Master looks up the cache, and shares the result, so that either
+	// all ranks or none of them go tuning.
+	Tuning tuning;
+	int found = 0;
+	if (process->isMaster())
+	{
+		ifstream file(filename.c_str());
+		string isaName;
+		// Entries of an unknown instruction set or a broken tile
+		// are tuned again.
+		if ((file >> isaName >> tuning.jit >> tuning.tile >> tuning.pointsPerSecond) && (tuning.tile >= 1))
+			for (int isa = 0; isa <= isaMax; isa++)
+				if (isaName == ISA::getName((ISA::Kind)isa))
+				{
+					tuning.isa = isa;
+					found = 1;
+				}
+	}
+	MPI_ERR_CHECK(MPI_Bcast(&found, 1, MPI_INT, 0, MPI_COMM_WORLD));
+	if (found)
+	{
+		MPI_ERR_CHECK(MPI_Bcast(&tuning, sizeof(Tuning), MPI_BYTE, 0, MPI_COMM_WORLD));
+		data->tuning = tuning;
+		data->tuned = true;
+
+		if (process->isMaster())
+			cout << "Using autotuned CPU kernels for dim = " << data->dim << " from " << filename << endl;
+		return;
+	}
+
+	Vector<real> x(npoints * data->dim);
+	getSample(data->index[0], data->dim, data->nno, npoints, data->dim, x.getData());
+	Vector<real> value(npoints * data->TotalDof);
+
+	vector<Tuning> candidates;
+	for (int isa = 0; isa <= isaMax; isa++)
+		for (int tile = 1; ; tile = min(2 * tile, npoints))
+		{
+			Tuning candidate;
+			candidate.isa = isa;
+			candidate.jit = 0;
+			candidate.tile = tile;
+			candidates.push_back(candidate);
+
+			// Runtime-optimized kernels are built for the instruction set
+			// of all ranks, with generic kernels as a fallback only.
+			if (jit && (isa == isaMax))
+			{
+				candidate.jit = 1;
+				candidates.push_back(candidate);
+			}
+
+			if (tile == npoints) break;
+		}
+
+	// Candidates run through the normal path, but are not calls of the solver.
+	Recorder::suspend(true);
+	Profiler::suspend(true);
+
+	vector<double> times(candidates.size());
+	for (int c = 0; c < (int)candidates.size(); c++)
+	{
+		data->tuning = candidates[c];
+		data->tuned = true;
+
+		// Compile kernels synchronously (on all ranks at once)
+		// and take page faults out of the timed loop.
+		Warmup::run(NULL, data, npoints);
+
+		double best = 0;
+		for (int r = 0; r < nrepeats; r++)
+		{
+			long long begin = Tracer::now();
+			interp->interpolate(NULL, data, 0, x.getData(), 0, data->TotalDof - 1, npoints, value.getData());
+			long long end = Tracer::now();
+
+			double time = (end - begin) * 1e-9;
+			if (!r || (time < best)) best = time;
+		}
+		times[c] = best;
+	}
+
+	Recorder::suspend(false);
+	Profiler::suspend(false);
+
+	MPI_ERR_CHECK(MPI_Allreduce(MPI_IN_PLACE, &times[0], times.size(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD));
+
+	int fastest = 0;
+	for (int c = 1; c < (int)candidates.size(); c++)
+		if (times[c] < times[fastest])
+			fastest = c;
+
+	tuning = candidates[fastest];
+	tuning.pointsPerSecond = npoints * process->getSize() / times[fastest];
+	data->tuning = tuning;
+	data->tuned = true;
+
+	if (!process->isMaster()) return;
+
+	cout << "Autotuned CPU kernels for dim = " << data->dim << " : " <<
+		ISA::getName((ISA::Kind)tuning.isa) << (tuning.jit ? " jit" : " generic") <<
+		", tile = " << tuning.tile << ", " << tuning.pointsPerSecond << " points/s" << endl;
+
+	// Write into temporary file and rename it, so that concurrent runs
+	// never read a partially written file.
+	stringstream stmpfilename;
+	stmpfilename << filename << "." << getpid();
+	string tmpfilename = stmpfilename.str();
+	{
+		ofstream file(tmpfilename.c_str());
+		file << ISA::getName((ISA::Kind)tuning.isa) << " " << tuning.jit << " " <<
+			tuning.tile << " " << tuning.pointsPerSecond << endl;
+		if (!file.good())
+		{
+			cerr << "Cannot write autotuning result to " << tmpfilename << endl;
+			return;
+		}
+	}
+	if (rename(tmpfilename.c_str(), filename.c_str()))
+	{
+		cerr << "Cannot write autotuning result to " << filename << endl;
+		unlink(tmpfilename.c_str());
+	}
+}
+
+bool Autotuner::getTuning(const Data* data, Tuning* tuning)
+{
+	if (!data->tuned) return false;
+
+	*tuning = data->tuning;
+	return true;
+}
+
+// Tune kernels for the given data with all states loaded, if AUTOTUNE
+// is set. Collective: all ranks shall call it with the same data, e.g.
+// before warmupInterpolator.
+extern "C" void tune(Data* data)
+{
+	if (Autotuner::isEnabled())
+		Autotuner::tune(data);
+}
+
+// Get kernel configuration tuned for the given data, for the solver
+// to compare backends by measured throughput rather than by priority.
+// Returns false, if data is not tuned.
+extern "C" bool getTuning(const Data* data, Tuning* tuning)
+{
+	return Autotuner::getTuning(data, tuning);
+}
@@ -0,0 +1,186 @@
+#include "Arena.h"
+#include "check.h"
+#include "Coalescer.h"
+#include "Data.h"
+#include "Deterministic.h"
+#include "interpolator.h"
+#include "Tracer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <pthread.h>
+#include <time.h>
+#include <vector>
+
+using namespace cpu;
+using namespace std;
+
+namespace {
+
+struct Key
+{
+	const Data* data;
+	int istate, Dof_choice_start, Dof_choice_end;
+
+	bool operator<(const Key& other) const
+	{
+		if (data != other.data) return data < other.data;
+		if (istate != other.istate) return istate < other.istate;
+		if (Dof_choice_start != other.Dof_choice_start) return Dof_choice_start < other.Dof_choice_start;
+		return Dof_choice_end < other.Dof_choice_end;
+	}
+};
+
+struct Batch
+{
+	vector<const real*> x;
+	vector<real*> value;
+
+	// Threads still referring to the batch.
+	int refs;
+
+	bool done;
+
+	// Signaled once batch is full, and once it is done.
+	pthread_cond_t full, ready;
+};
+
+} // namespace
+
+// Batches open for new points.
+static map<Key, Batch*> batches;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long window = 10;
+static int maxBatch = 16;
+
+bool Coalescer::isEnabled()
+{
+	static int enabled = -1;
+	if (enabled != -1) return enabled;
+
+	const char* windowValue = getenv("COALESCE_WINDOW");
+	if (windowValue)
+		window = max(0, atoi(windowValue));
+
+	const char* maxBatchValue = getenv("COALESCE_BATCH");
+	if (maxBatchValue)
+		maxBatch = max(1, atoi(maxBatchValue));
+
+	// Batches depend on timing of callers, thus are never made in
+	// deterministic mode.
+	enabled = (getenv("COALESCE") != NULL) && !Deterministic::isEnabled();
+	return enabled;
+}
+
+static void release(Batch* batch)
+{
+	if (--batch->refs) return;
+
+	PTHREAD_ERR_CHECK(pthread_cond_destroy(&batch->full));
+	PTHREAD_ERR_CHECK(pthread_cond_destroy(&batch->ready));
+	delete batch;
+}
+
+void Coalescer::interpolate(Device* device, const Data* data, const int istate, const real* x,
+	const int Dof_choice_start, const int Dof_choice_end, real* value)
+{
+	Key key;
+	key.data = data;
+	key.istate = istate;
+	key.Dof_choice_start = Dof_choice_start;
+	key.Dof_choice_end = Dof_choice_end;
+
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+
+	map<Key, Batch*>::iterator i = batches.find(key);
+	if (i != batches.end())
+	{
+		// Join the open batch, and wait for the results.
+		Batch* batch = i->second;
+		batch->x.push_back(x);
+		batch->value.push_back(value);
+		batch->refs++;
+		if ((int)batch->x.size() == maxBatch)
+		{
+			batches.erase(i);
+			PTHREAD_ERR_CHECK(pthread_cond_signal(&batch->full));
+		}
+
+		while (!batch->done)
+			PTHREAD_ERR_CHECK(pthread_cond_wait(&batch->ready, &mutex));
+		release(batch);
+
+		PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+		return;
+	}
+
+	// Open a new batch, and wait for others to join.
+	Batch* batch = new Batch();
+	batch->x.push_back(x);
+	batch->value.push_back(value);
+	batch->refs = 1;
+	batch->done = false;
+	pthread_condattr_t attr;
+	PTHREAD_ERR_CHECK(pthread_condattr_init(&attr));
+	PTHREAD_ERR_CHECK(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC));
+	PTHREAD_ERR_CHECK(pthread_cond_init(&batch->full, &attr));
+	PTHREAD_ERR_CHECK(pthread_condattr_destroy(&attr));
+	PTHREAD_ERR_CHECK(pthread_cond_init(&batch->ready, NULL));
+
+	if (maxBatch > 1)
+	{
+		batches[key] = batch;
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += window * 1000;
+		deadline.tv_sec += deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+
+		while ((int)batch->x.size() < maxBatch)
+			if (pthread_cond_timedwait(&batch->full, &mutex, &deadline))
+				break;
+
+		// Close the batch, unless it is closed being full.
+		i = batches.find(key);
+		if ((i != batches.end()) && (i->second == batch))
+			batches.erase(i);
+	}
+
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+
+	{
+		TRACE_SCOPE("Coalescer::interpolate");
+
+		const int count = batch->x.size();
+		const int TotalDof = Dof_choice_end - Dof_choice_start + 1;
+		const int dim = data->dim;
+
+		if (count == 1)
+			Interpolator::getInstance()->interpolate(device, data, istate, x,
+				Dof_choice_start, Dof_choice_end, 1, value);
+		else
+		{
+			Arena& arena = Arena::get();
+			Arena::Scope scope(arena);
+			real* xs = arena.allocate<real>(count * dim);
+			real* values = arena.allocate<real>(count * TotalDof);
+			for (int p = 0; p < count; p++)
+				memcpy(xs + p * dim, batch->x[p], sizeof(real) * dim);
+
+			Interpolator::getInstance()->interpolate(device, data, istate, xs,
+				Dof_choice_start, Dof_choice_end, count, values);
+
+			for (int p = 0; p < count; p++)
+				memcpy(batch->value[p], values + p * TotalDof, sizeof(real) * TotalDof);
+		}
+	}
+
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+	batch->done = true;
+	PTHREAD_ERR_CHECK(pthread_cond_broadcast(&batch->ready));
+	release(batch);
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+}
@@ -0,0 +1,177 @@
+#ifdef HAVE_COUNTERS
+
+#include "check.h"
+#include "Counters.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mpi.h>
+#include <sstream>
+
+using namespace cpu;
+using namespace std;
+
+static const char* names[] =
+{
+	"DataLoad",
+	"JITCompile",
+	"InterpolateValue",
+	"InterpolateArray",
+	"InterpolateArrayManyStateless",
+	"InterpolateArrayManyMultistate"
+};
+
+// Counters of all threads ever used, never freed: a thread could exit
+// before finalize, but its counters shall still be reported.
+static Counters::Thread* threads = NULL;
+static int nthreads = 0;
+
+static __thread Counters::Thread* thread = NULL;
+
+Counters::Thread& Counters::getThread()
+{
+	if (thread) return *thread;
+
+	thread = new Thread();
+	memset(thread, 0, sizeof(Thread));
+	thread->id = __sync_fetch_and_add(&nthreads, 1);
+
+	// Lock-free push into the list of all threads.
+	do thread->next = threads;
+	while (!__sync_bool_compare_and_swap(&threads, thread->next, thread));
+
+	return *thread;
+}
+
+extern "C" void LinearBasis_CPU_Counters_addRows(int kind,
+	unsigned long long visited, unsigned long long active, unsigned long long bytes)
+{
+	Counters::Thread& thread = Counters::getThread();
+	thread.rowsVisited[kind] += visited;
+	thread.rowsActive[kind] += active;
+	thread.bytes[kind] += bytes;
+}
+
+// Write counters of all threads in Prometheus text exposition format.
+static void dump(const char* prefix, int rank)
+{
+	stringstream filename;
+	filename << prefix << "." << rank;
+	ofstream out(filename.str().c_str());
+	if (!out.is_open())
+	{
+		cerr << "Cannot open counters dump file " << filename.str() << endl;
+		return;
+	}
+
+	struct Metric
+	{
+		const char* name;
+		const char* help;
+	};
+
+	const Metric metrics[] =
+	{
+		{ "hddm_calls_total", "Number of calls" },
+		{ "hddm_cycles_total", "TSC cycles spent" },
+		{ "hddm_rows_visited_total", "Sparse grid rows visited" },
+		{ "hddm_rows_active_total", "Sparse grid rows not rejected by early exit" },
+		{ "hddm_bytes_streamed_total", "Bytes of index and surplus streamed" }
+	};
+
+	for (int m = 0; m < (int)(sizeof(metrics) / sizeof(metrics[0])); m++)
+	{
+		out << "# HELP " << metrics[m].name << " " << metrics[m].help << endl;
+		out << "# TYPE " << metrics[m].name << " counter" << endl;
+		for (Counters::Thread* t = threads; t; t = t->next)
+			for (int kind = 0; kind < CounterKindCount; kind++)
+			{
+				const unsigned long long* values[] =
+					{ t->calls, t->cycles, t->rowsVisited, t->rowsActive, t->bytes };
+				out << metrics[m].name << "{rank=\"" << rank << "\",thread=\"" << t->id <<
+					"\",kind=\"" << names[kind] << "\"} " << values[m][kind] << endl;
+			}
+	}
+
+	out << "# HELP hddm_scratch_high_water_bytes Largest scratch memory used at once" << endl;
+	out << "# TYPE hddm_scratch_high_water_bytes gauge" << endl;
+	for (Counters::Thread* t = threads; t; t = t->next)
+		out << "hddm_scratch_high_water_bytes{rank=\"" << rank << "\",thread=\"" << t->id << "\"} " <<
+			t->scratchHighWater << endl;
+}
+
+// Called at MPI_Finalize, while MPI is still usable, as attributes
+// of MPI_COMM_SELF are deleted first.
+static int finalize(MPI_Comm comm, int keyval, void* value, void* extra)
+{
+	int rank;
+	MPI_ERR_CHECK(MPI_Comm_rank(MPI_COMM_WORLD, &rank));
+
+	const char* prefix = getenv("COUNTERS_DUMP");
+	if (prefix)
+		dump(prefix, rank);
+
+	// Per-rank totals over all threads.
+	const int nvalues = 5 * CounterKindCount;
+	unsigned long long totals[nvalues];
+	memset(totals, 0, sizeof(totals));
+	for (Counters::Thread* t = threads; t; t = t->next)
+		for (int kind = 0; kind < CounterKindCount; kind++)
+		{
+			totals[kind] += t->calls[kind];
+			totals[kind + CounterKindCount] += t->cycles[kind];
+			totals[kind + 2 * CounterKindCount] += t->rowsVisited[kind];
+			totals[kind + 3 * CounterKindCount] += t->rowsActive[kind];
+			totals[kind + 4 * CounterKindCount] += t->bytes[kind];
+		}
+
+	unsigned long long sums[nvalues], maxs[nvalues];
+	MPI_ERR_CHECK(MPI_Reduce(totals, sums, nvalues, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD));
+	MPI_ERR_CHECK(MPI_Reduce(totals, maxs, nvalues, MPI_UNSIGNED_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD));
+
+	unsigned long long scratchHighWater = 0, maxScratchHighWater;
+	for (Counters::Thread* t = threads; t; t = t->next)
+		scratchHighWater = max(scratchHighWater, t->scratchHighWater);
+	MPI_ERR_CHECK(MPI_Reduce(&scratchHighWater, &maxScratchHighWater, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD));
+
+	if (rank) return MPI_SUCCESS;
+
+	cout << "Performance counters, summed over all ranks (max cycles per rank):" << endl;
+	cout << setw(32) << left << "kind" << right <<
+		setw(12) << "calls" << setw(16) << "cycles" << setw(16) << "max cycles" <<
+		setw(16) << "rows visited" << setw(16) << "rows active" << setw(16) << "bytes" << endl;
+	for (int kind = 0; kind < CounterKindCount; kind++)
+	{
+		if (!sums[kind]) continue;
+
+		cout << setw(32) << left << names[kind] << right <<
+			setw(12) << sums[kind] <<
+			setw(16) << sums[kind + CounterKindCount] <<
+			setw(16) << maxs[kind + CounterKindCount] <<
+			setw(16) << sums[kind + 2 * CounterKindCount] <<
+			setw(16) << sums[kind + 3 * CounterKindCount] <<
+			setw(16) << sums[kind + 4 * CounterKindCount] << endl;
+	}
+	if (maxScratchHighWater)
+		cout << "Scratch memory high-water mark (max over threads): " << maxScratchHighWater << " bytes" << endl;
+
+	return MPI_SUCCESS;
+}
+
+void Counters::initialize()
+{
+	static bool initialized = false;
+	if (initialized) return;
+	initialized = true;
+
+	int keyval;
+	MPI_ERR_CHECK(MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, finalize, &keyval, NULL));
+	MPI_ERR_CHECK(MPI_Comm_set_attr(MPI_COMM_SELF, keyval, NULL));
+}
+
+#endif // HAVE_COUNTERS
+
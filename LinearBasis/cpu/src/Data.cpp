@@ -1,10 +1,19 @@
 #include "check.h"
+#include "Counters.h"
 #include "Data.h"
+#include "Devices.h"
 #include "interpolator.h"
+#include "Tracer.h"
 
+#include <cerrno>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <mpi.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace cpu;
 using namespace std;
@@ -39,103 +48,63 @@ static bool isCompressed(const char* filename)
 	return compressed;
 }
 
-struct IndexPair
-{
-	unsigned short i, j;
-};
-
-template<typename T>
-static void read_index(ifstream& infile, int nno, int dim, int vdim, Matrix<int>& index_)
+// Check row offsets and column indexes of sparse matrix.
+static void check_csr(int nno, int ncols, const int* IA, const int* JA)
 {
 	MPI_Process* process;
 	MPI_ERR_CHECK(MPI_Process_get(&process));
 
-	char index_marker[] = "index";
-	infile.read(index_marker, strlen(index_marker));
-
-	unsigned int index_nonzeros = 0;
-	infile.read(reinterpret_cast<char*>(&index_nonzeros), sizeof(unsigned int));
-
-	vector<int> A;
-	A.resize(index_nonzeros);
-	for (int i = 0, e = A.size(); i != e; i++)
-		infile.read(reinterpret_cast<char*>(&A[i]), sizeof(IndexPair));
-
-	vector<int> IA;
-	IA.resize(nno + 1);
-	{
-		T value;
-		infile.read(reinterpret_cast<char*>(&value), sizeof(T));
-		IA[0] = value;
-	}
-	for (int i = 1, e = IA.size(); i != e; i++)
-	{
-		T value;
-		infile.read(reinterpret_cast<char*>(&value), sizeof(T));
-		IA[i] = (int)value + IA[i - 1];
-	}
-
 	if (IA[0] != 0)
 	{
 		cerr << "IA[0] must be 0" << endl;
 		process->abort();
 	}
 
-	for (int i = 1, e = IA.size(); i != e; i++)
+	for (int i = 1; i != nno + 1; i++)
 		if (IA[i] < IA[i - 1])
 		{
 			cerr << "IA[i] must be not less than IA[i - 1] - not true for IA[" << i << "] >= IA[" << (i - 1) <<
 				"] : " << IA[i] << " < " << IA[i - 1] << endl;
 			process->abort();
 		}
-	
-	vector<int> JA;
-	JA.resize(index_nonzeros);
-	for (int i = 0, e = JA.size(); i != e; i++)
-	{
-		T value;
-		infile.read(reinterpret_cast<char*>(&value), sizeof(T));
-		JA[i] = (int)value;
-	}
 
-	for (int i = 0, e = JA.size(); i != e; i++)
+	for (int i = 0, e = IA[nno]; i != e; i++)
 	{
-		if (JA[i] >= dim)
+		if (JA[i] >= ncols)
 		{
 			cerr << "JA[i] must be within column index range - not true for JA[" << i << "] = " << JA[i] << endl;
 			process->abort();
 		}
 	}
+}
+
+static void decode_index(const CSR<IndexPair>& csr, int nno, int dim, int vdim, Matrix<int>& index_)
+{
+	check_csr(nno, dim, csr.IA, csr.JA);
 
 	for (int i = 0, row = 0; row < nno; row++)
-		for (int col = IA[row]; col < IA[row + 1]; col++, i++)
+		for (int col = csr.IA[row]; col < csr.IA[row + 1]; col++, i++)
 		{
-			IndexPair& pair = (IndexPair&)A[i];
-			index_(row, JA[i]) = pair.i;
-			index_(row, JA[i] + vdim * AVX_VECTOR_SIZE) = pair.j;
+			const IndexPair& pair = csr.A[i];
+			index_(row, csr.JA[i]) = pair.i;
+			index_(row, csr.JA[i] + vdim * AVX_VECTOR_SIZE) = pair.j;
 		}
-	
-	//cout << (100 - (double)index_nonzeros / (nno * dim) * 100) << "% index sparsity" << endl;
 }
 
-template<typename T>
-static void read_surplus(ifstream& infile, int nno, int TotalDof, Matrix<double>& surplus_)
+static void decode_surplus(const CSR<double>& csr, int nno, int TotalDof, Matrix<double>& surplus_)
 {
-	MPI_Process* process;
-	MPI_ERR_CHECK(MPI_Process_get(&process));
-
-	char surplus_marker[] = "surplus";
-	infile.read(surplus_marker, strlen(surplus_marker));
+	check_csr(nno, TotalDof, csr.IA, csr.JA);
 
-	unsigned int surplus_nonzeros = 0;
-	infile.read(reinterpret_cast<char*>(&surplus_nonzeros), sizeof(unsigned int));
-
-	vector<double> A;
-	A.resize(surplus_nonzeros);
-	for (int i = 0, e = A.size(); i != e; i++)
-		infile.read(reinterpret_cast<char*>(&A[i]), sizeof(double));
+	for (int i = 0, row = 0; row < nno; row++)
+		for (int col = csr.IA[row]; col < csr.IA[row + 1]; col++, i++)
+			surplus_(row, csr.JA[i]) = csr.A[i];
+}
 
-	vector<int> IA;
+// Read row offsets, stored as row lengths, and column indexes
+// of sparse matrix.
+template<typename T>
+static void read_csr(ifstream& infile, int nno, int nonzeros, vector<int>& IA, vector<int>& JA)
+{
 	IA.resize(nno + 1);
 	{
 		T value;
@@ -149,57 +118,84 @@ static void read_surplus(ifstream& infile, int nno, int TotalDof, Matrix<double>
 		IA[i] = (int)value + IA[i - 1];
 	}
 
-	if (IA[0] != 0)
-	{
-		cerr << "IA[0] must be 0" << endl;
-		process->abort();
-	}
-
-	for (int i = 1, e = IA.size(); i != e; i++)
-		if (IA[i] < IA[i - 1])
-		{
-			cerr << "IA[i] must be not less than IA[i - 1] - not true for IA[" << i << "] >= IA[" << (i - 1) <<
-				"] : " << IA[i] << " < " << IA[i - 1] << endl;
-			process->abort();
-		}
-	
-	vector<int> JA;
-	JA.resize(surplus_nonzeros);
+	JA.resize(nonzeros);
 	for (int i = 0, e = JA.size(); i != e; i++)
 	{
 		T value;
 		infile.read(reinterpret_cast<char*>(&value), sizeof(T));
 		JA[i] = (int)value;
 	}
+}
 
-	for (int i = 0, e = JA.size(); i != e; i++)
-	{
-		if (JA[i] >= TotalDof)
-		{
-			cerr << "JA[i] must be within column index range - not true for JA[" << i << "] = " << JA[i] << endl;
-			process->abort();
-		}
-	}
+template<typename T>
+static void read_index(ifstream& infile, int nno, int dim, int vdim, Matrix<int>& index_)
+{
+	char index_marker[] = "index";
+	infile.read(index_marker, strlen(index_marker));
 
-	for (int i = 0, row = 0; row < nno; row++)
-		for (int col = IA[row]; col < IA[row + 1]; col++, i++)
-			surplus_(row, JA[i]) = A[i];
+	unsigned int index_nonzeros = 0;
+	infile.read(reinterpret_cast<char*>(&index_nonzeros), sizeof(unsigned int));
+
+	vector<IndexPair> A;
+	A.resize(index_nonzeros);
+	for (int i = 0, e = A.size(); i != e; i++)
+		infile.read(reinterpret_cast<char*>(&A[i]), sizeof(IndexPair));
+
+	vector<int> IA, JA;
+	read_csr<T>(infile, nno, index_nonzeros, IA, JA);
+
+	CSR<IndexPair> csr = { A.data(), IA.data(), JA.data() };
+	decode_index(csr, nno, dim, vdim, index_);
+	
+	//cout << (100 - (double)index_nonzeros / (nno * dim) * 100) << "% index sparsity" << endl;
+}
+
+template<typename T>
+static void read_surplus(ifstream& infile, int nno, int TotalDof, Matrix<double>& surplus_)
+{
+	char surplus_marker[] = "surplus";
+	infile.read(surplus_marker, strlen(surplus_marker));
+
+	unsigned int surplus_nonzeros = 0;
+	infile.read(reinterpret_cast<char*>(&surplus_nonzeros), sizeof(unsigned int));
+
+	vector<double> A;
+	A.resize(surplus_nonzeros);
+	for (int i = 0, e = A.size(); i != e; i++)
+		infile.read(reinterpret_cast<char*>(&A[i]), sizeof(double));
+
+	vector<int> IA, JA;
+	read_csr<T>(infile, nno, surplus_nonzeros, IA, JA);
+
+	CSR<double> csr = { A.data(), IA.data(), JA.data() };
+	decode_surplus(csr, nno, TotalDof, surplus_);
 	
 	//cout << (100 - (double)surplus_nonzeros / (nno * TotalDof) * 100) << "% surplus sparsity" << endl;
 }
 
 void Data::load(const char* filename, int istate)
 {
+	COUNTERS_SCOPE(CounterDataLoad);
+	TRACE_SCOPE("Data::load");
+
 	MPI_Process* process;
 	MPI_ERR_CHECK(MPI_Process_get(&process));
 	const Parameters& params = Interpolator::getInstance()->getParameters();
 
+	if (!strncmp(filename, "shm:", 4))
+	{
+		loadShared(filename + 4, istate);
+		return;
+	}
+
 	if (loadedStates[istate])
 	{
 		cerr << "State " << istate << " data is already loaded" << endl;
 		process->abort();
 	}
 
+	Tracer::Scope traceOpen("open");
+
 	bool compressed = isCompressed(filename);
 
 	ifstream infile;
@@ -214,6 +210,10 @@ void Data::load(const char* filename, int istate)
 		process->abort();
 	}
 
+	traceOpen.end();
+
+	Tracer::Scope traceHeader("header");
+
 	if (compressed)
 	{
 		char format_marker[] = "          ";		
@@ -231,6 +231,8 @@ void Data::load(const char* filename, int istate)
 		infile >> Level;
 	}
 
+	traceHeader.end();
+
 	if (dim != params.nagents)
 	{
 		cerr << "File \"" << filename << "\" # of dimensions (" << dim << 
@@ -253,6 +255,9 @@ void Data::load(const char* filename, int istate)
 	surplus_t[istate].fill(0.0);
 	if (!compressed)
 	{
+		// Index and surplus are interleaved row by row in text format.
+		TRACE_SCOPE("text decode");
+
 		int j = 0;
 		while (infile)
 		{
@@ -300,6 +305,8 @@ void Data::load(const char* filename, int istate)
 	
 		//cout << "Using " << szt << "-byte IA/JA size for index" << endl;
 	
+		Tracer::Scope traceIndex("index decode");
+
 		switch (szt)
 		{
 		case 1 :
@@ -313,6 +320,8 @@ void Data::load(const char* filename, int istate)
 			break;
 		}
 
+		traceIndex.end();
+
 		if (TotalDof <= numeric_limits<unsigned char>::max())
 			szt = 1;
 		else if (TotalDof <= numeric_limits<unsigned short>::max())
@@ -323,6 +332,8 @@ void Data::load(const char* filename, int istate)
 		//cout << endl;
 		//cout << "Using " << szt << "-byte IA/JA size for surplus" << endl;
 	
+		TRACE_SCOPE("surplus decode");
+
 		switch (szt)
 		{
 		case 1 :
@@ -337,23 +348,320 @@ void Data::load(const char* filename, int istate)
 		}
 	}
 	
+#ifdef HAVE_COUNTERS
+	// Bytes of file consumed, unless reading stopped on error.
+	streamoff bytes = infile.tellg();
+	if (bytes > 0)
+		COUNTERS_BYTES(CounterDataLoad, bytes);
+#endif
+
 	infile.close();
-	
+
+	finish(istate);
+}
+
+void Data::prepare(const char* source, int istate, int dim_, int nno_, int TotalDof_, int Level_)
+{
+	MPI_Process* process;
+	MPI_ERR_CHECK(MPI_Process_get(&process));
+	const Parameters& params = Interpolator::getInstance()->getParameters();
+
+	if (loadedStates[istate])
+	{
+		cerr << "State " << istate << " data is already loaded" << endl;
+		process->abort();
+	}
+
+	if (dim_ != params.nagents)
+	{
+		cerr << "Data " << source << " # of dimensions (" << dim_ << 
+			") mismatches config (" << params.nagents << ")" << endl;
+		process->abort();
+	}
+
+	dim = dim_; nno = nno_; TotalDof = TotalDof_; Level = Level_;
+
+	// Pad all indexes to 4-element boundary.
+	vdim = dim / AVX_VECTOR_SIZE;
+	if (dim % AVX_VECTOR_SIZE) vdim++;
+}
+
+void Data::finish(int istate)
+{
 	loadedStates[istate] = true;
+
+	place(istate);
+}
+
+// Aligned as own storage of Matrix<T>.
+template<typename T>
+static bool isAligned(const T* ptr)
+{
+	return !((size_t)ptr % (AVX_VECTOR_SIZE * sizeof(T)));
+}
+
+void Data::load(int dim_, int nno_, int TotalDof_, int Level_,
+	const int* index_, int ldindex, const real* surplus_, int ldsurplus, int istate)
+{
+	COUNTERS_SCOPE(CounterDataLoad);
+	TRACE_SCOPE("Data::load dense");
+
+	prepare("in memory", istate, dim_, nno_, TotalDof_, Level_);
+
+	int nsd = 2 * vdim * AVX_VECTOR_SIZE;
+
+	// Index is used in place, if it has the layout of own storage,
+	// otherwise its halves are copied into padded rows.
+	if ((ldindex == nsd) && isAligned(index_))
+		index[istate].adopt(const_cast<int*>(index_), nno, nsd);
+	else
+	{
+		index[istate].resize(nno, nsd);
+		index[istate].fill(0);
+		for (int j = 0; j < nno; j++)
+		{
+			const int* row = index_ + (size_t)j * ldindex;
+			memcpy(&index[istate](j, 0), row, sizeof(int) * dim);
+			memcpy(&index[istate](j, vdim * AVX_VECTOR_SIZE), row + ldindex / 2, sizeof(int) * dim);
+		}
+		COUNTERS_BYTES(CounterDataLoad, (size_t)nno * dim * 2 * sizeof(int));
+	}
+
+	int ldTotalDof = TotalDof;
+	if (TotalDof % AVX_VECTOR_SIZE)
+		ldTotalDof += AVX_VECTOR_SIZE - TotalDof % AVX_VECTOR_SIZE;
+
+	if ((ldsurplus == ldTotalDof) && isAligned(surplus_))
+		surplus[istate].adopt(const_cast<real*>(surplus_), nno, TotalDof);
+	else
+	{
+		surplus[istate].resize(nno, TotalDof);
+		surplus[istate].fill(0.0);
+		for (int j = 0; j < nno; j++)
+			memcpy(&surplus[istate](j, 0), surplus_ + (size_t)j * ldsurplus, sizeof(real) * TotalDof);
+		COUNTERS_BYTES(CounterDataLoad, (size_t)nno * TotalDof * sizeof(real));
+	}
+
+	finish(istate);
+}
+
+void Data::load(int dim_, int nno_, int TotalDof_, int Level_,
+	const CSR<IndexPair>& index_, const CSR<real>& surplus_, int istate)
+{
+	COUNTERS_SCOPE(CounterDataLoad);
+	TRACE_SCOPE("Data::load sparse");
+
+	prepare("in memory", istate, dim_, nno_, TotalDof_, Level_);
+
+	index[istate].resize(nno, 2 * vdim * AVX_VECTOR_SIZE);
+	index[istate].fill(0);
+	decode_index(index_, nno, dim, vdim, index[istate]);
+
+	surplus[istate].resize(nno, TotalDof);
+	surplus[istate].fill(0.0);
+	decode_surplus(surplus_, nno, TotalDof, surplus[istate]);
+
+	COUNTERS_BYTES(CounterDataLoad, (size_t)index_.IA[nno] * (sizeof(IndexPair) + sizeof(int)) +
+		(size_t)surplus_.IA[nno] * (sizeof(real) + sizeof(int)) + 2 * (size_t)(nno + 1) * sizeof(int));
+
+	finish(istate);
+}
+
+void Data::loadShared(const char* name, int istate)
+{
+	COUNTERS_SCOPE(CounterDataLoad);
+	TRACE_SCOPE("Data::load shared");
+
+	MPI_Process* process;
+	MPI_ERR_CHECK(MPI_Process_get(&process));
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd == -1)
+	{
+		cerr << "Error opening shared memory object " << name << ": " << strerror(errno) << endl;
+		process->abort();
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) || (st.st_size < (off_t)sizeof(SharedHeader)))
+	{
+		cerr << "Shared memory object " << name << " has no data header" << endl;
+		process->abort();
+	}
+
+	// Mapping is read-only and shared, thus all processes on the node
+	// use the same physical pages.
+	size_t size = st.st_size;
+	void* ptr = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ptr == MAP_FAILED)
+	{
+		cerr << "Error mapping shared memory object " << name << ": " << strerror(errno) << endl;
+		process->abort();
+	}
+
+	const SharedHeader& header = *(const SharedHeader*)ptr;
+	if (strncmp(header.marker, "shared", sizeof(header.marker)))
+	{
+		cerr << "Shared memory object " << name << " has no data header" << endl;
+		process->abort();
+	}
+
+	// Object may be written by anyone, thus the shape and layout are
+	// checked, before any size is computed from them: both arrays shall
+	// start after the header, be aligned, and fit into the object.
+	if ((header.dim < 1) || (header.nno < 0) || (header.TotalDof < 1) || (header.Level < 0))
+	{
+		cerr << "Shared memory object " << name << " has invalid shape of data" << endl;
+		process->abort();
+	}
+
+	int nsd = header.dim / AVX_VECTOR_SIZE;
+	if (header.dim % AVX_VECTOR_SIZE) nsd++;
+	nsd *= 2 * AVX_VECTOR_SIZE;
+	int ldTotalDof = header.TotalDof / AVX_VECTOR_SIZE;
+	if (header.TotalDof % AVX_VECTOR_SIZE) ldTotalDof++;
+	ldTotalDof *= AVX_VECTOR_SIZE;
+
+	const size_t indexRow = (size_t)nsd * sizeof(int), surplusRow = (size_t)ldTotalDof * sizeof(real);
+	const size_t space = size - sizeof(SharedHeader);
+	if (((size_t)header.nno > space / indexRow) || ((size_t)header.nno > space / surplusRow) ||
+		(header.indexOffset < (long)sizeof(SharedHeader)) || (header.surplusOffset < (long)sizeof(SharedHeader)) ||
+		(header.indexOffset % (AVX_VECTOR_SIZE * sizeof(int))) || (header.surplusOffset % (AVX_VECTOR_SIZE * sizeof(real))) ||
+		((size_t)header.indexOffset > size - header.nno * indexRow) ||
+		((size_t)header.surplusOffset > size - header.nno * surplusRow))
+	{
+		cerr << "Shared memory object " << name << " has invalid layout of index or surplus" << endl;
+		process->abort();
+	}
+
+	string source = (string)"shm:" + name;
+	prepare(source.c_str(), istate, header.dim, header.nno, header.TotalDof, header.Level);
+
+	index[istate].adopt((int*)((char*)ptr + header.indexOffset), nno, nsd);
+	surplus[istate].adopt((real*)((char*)ptr + header.surplusOffset), nno, TotalDof);
+
+	mappings[istate] = make_pair(ptr, size);
+
+	finish(istate);
+}
+
+namespace cpu
+{
+	extern Devices devices;
+}
+
+void Data::place(int istate)
+{
+	TRACE_SCOPE("Data::place");
+
+	const vector<int>& nodes = Placement::getNodes();
+	if ((nodes.size() <= 1) || !nno) return;
+
+	Matrix<int>& index = this->index[istate];
+	Matrix<real>& surplus = this->surplus[istate];
+
+	// Pages of adopted memory, of the caller or mapped from shared memory
+	// (possibly read-only), are not moved: they are not owned by data, and
+	// may be used by others. Replication copies them as any other.
+	const bool moveIndex = !index.isAdopted(), moveSurplus = !surplus.isAdopted();
+
+	switch (placement)
+	{
+	case Placement::Local :
+		break;
+	case Placement::Interleave :
+		if (moveIndex)
+			Placement::interleave(index.getData(), index.getSize());
+		if (moveSurplus)
+			Placement::interleave(surplus.getData(), surplus.getSize());
+		break;
+	case Placement::Partition :
+		{
+			// Rows are split at the same points in index and surplus.
+			int ndevices = devices.getCount();
+			size_t indexRow = index.getSize() / nno, surplusRow = surplus.getSize() / nno;
+			for (int i = 0; i < ndevices; i++)
+			{
+				int first = (long)nno * i / ndevices, last = (long)nno * (i + 1) / ndevices;
+				int node = devices.getDevice(i)->getNode();
+				if (moveIndex)
+					Placement::bind((char*)index.getData() + first * indexRow, (last - first) * indexRow, node);
+				if (moveSurplus)
+					Placement::bind((char*)surplus.getData() + first * surplusRow, (last - first) * surplusRow, node);
+			}
+		}
+		break;
+	case Placement::Replicate :
+		for (int i = 0; i < (int)nodes.size(); i++)
+		{
+			int node = nodes[i];
+			if ((int)indexReplicas.size() <= node)
+			{
+				indexReplicas.resize(node + 1);
+				surplusReplicas.resize(node + 1);
+			}
+			if (indexReplicas[node].empty())
+			{
+				indexReplicas[node].resize(nstates);
+				surplusReplicas[node].resize(nstates);
+			}
+
+			Matrix<int>& indexReplica = indexReplicas[node][istate];
+			Matrix<real>& surplusReplica = surplusReplicas[node][istate];
+			indexReplica = index;
+			surplusReplica = surplus;
+			Placement::bind(indexReplica.getData(), indexReplica.getSize(), node);
+			Placement::bind(surplusReplica.getData(), surplusReplica.getSize(), node);
+		}
+		break;
+	default :
+		break;
+	}
+}
+
+void Data::setPlacement(Placement::Policy policy)
+{
+	placement = policy;
+
+	indexReplicas.clear();
+	surplusReplicas.clear();
+	for (int istate = 0; istate < nstates; istate++)
+		if (loadedStates[istate])
+			place(istate);
 }
 
 void Data::clear()
 {
 	fill(loadedStates.begin(), loadedStates.end(), false);
+	tuned = false;
+	indexReplicas.clear();
+	surplusReplicas.clear();
+
+	for (int istate = 0; istate < nstates; istate++)
+	{
+		if (!mappings[istate].first) continue;
+
+		index[istate].resize(0, 0);
+		surplus[istate].resize(0, 0);
+		munmap(mappings[istate].first, mappings[istate].second);
+		mappings[istate] = make_pair((void*)NULL, (size_t)0);
+	}
 }
 
-Data::Data(int nstates_) : nstates(nstates_)
+Data::Data(int nstates_) : nstates(nstates_), tuned(false), placement(Placement::getDefault())
 {
 	index.resize(nstates);
 	surplus.resize(nstates);
 	surplus_t.resize(nstates);
 	loadedStates.resize(nstates);
 	fill(loadedStates.begin(), loadedStates.end(), false);
+	mappings.resize(nstates, make_pair((void*)NULL, (size_t)0));
+}
+
+Data::~Data()
+{
+	clear();
 }
 
 extern "C" Data* getData(int nstates)
@@ -361,3 +669,19 @@ extern "C" Data* getData(int nstates)
 	return new Data(nstates);
 }
 
+
+// Load state from dense arrays in memory, used in place, if their layout
+// matches (see Data::load), for the solver to hand data over without
+// writing it into file.
+extern "C" void loadDataDense(Data* data, int dim, int nno, int TotalDof, int Level,
+	const int* index, int ldindex, const real* surplus, int ldsurplus, int istate)
+{
+	data->load(dim, nno, TotalDof, Level, index, ldindex, surplus, ldsurplus, istate);
+}
+
+// Load state from sparse arrays in memory, with the contents of compressed file.
+extern "C" void loadDataSparse(Data* data, int dim, int nno, int TotalDof, int Level,
+	const CSR<IndexPair>* index, const CSR<real>* surplus, int istate)
+{
+	data->load(dim, nno, TotalDof, Level, *index, *surplus, istate);
+}
@@ -0,0 +1,35 @@
+#include "Deterministic.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace cpu;
+using namespace std;
+
+static int block = 16;
+
+bool Deterministic::isEnabled()
+{
+	static int enabled = -1;
+	if (enabled != -1) return enabled;
+
+	const char* blockValue = getenv("DETERMINISTIC_BLOCK");
+	if (blockValue)
+		block = max(1, atoi(blockValue));
+
+	enabled = (getenv("DETERMINISTIC") != NULL);
+	return enabled;
+}
+
+int Deterministic::getBlock()
+{
+	isEnabled();
+	return block;
+}
+
+// Check, if interpolation is bit-for-bit reproducible, for the solver
+// to refuse validation runs in the default mode.
+extern "C" bool isDeterministic()
+{
+	return Deterministic::isEnabled();
+}
@@ -1,6 +1,28 @@
 #include "Device.h"
 
+#include <cstddef>
+
 using namespace cpu;
+using namespace std;
+
+Device::Device() : available(1), post(NULL), id(0), node(0), ncores(1), pool(NULL)
+{
+	for (int i = 0; i < 4; i++)
+		cacheSizes[i] = 0;
+}
+
+int Device::getID() const { return id; }
+
+int Device::getNode() const { return node; }
+
+const vector<int>& Device::getCPUs() const { return cpus; }
+
+int Device::getCoreCount() const { return ncores; }
 
-Device::Device() : available(1) { }
+long Device::getCacheSize(int level) const
+{
+	if ((level < 1) || (level > 3)) return 0;
+	return cacheSizes[level];
+}
 
+WorkerPool* Device::getWorkerPool() const { return pool; }
@@ -1,28 +1,69 @@
 #include "DeviceProperties.h"
+#include "Devices.h"
+#include "ISA.h"
 
-#include <vector>
+#include <memory>
 
 using namespace cpu;
 using namespace std;
 
-static SIMDVector simdVector;
+DeviceProperties::DeviceProperties(const Device* device_) : device(device_) { }
 
 const SIMDVector* DeviceProperties::getSIMDVector() const
 {
 	return &simdVector;
 }
 
-static DeviceProperties props;
-static vector<DeviceProperties*> vprops;
+int DeviceProperties::getNode() const
+{
+	return device->getNode();
+}
 
-extern "C" vector<DeviceProperties*>& getDeviceProperties()
+int DeviceProperties::getCoreCount() const
+{
+	return device->getCoreCount();
+}
+
+int DeviceProperties::getThreadCount() const
+{
+	return device->getCPUs().size();
+}
+
+long DeviceProperties::getCacheSize(int level) const
+{
+	return device->getCacheSize(level);
+}
+
+const char* DeviceProperties::getISA() const
+{
+	return ISA::getName(ISA::get());
+}
+
+static vector<unique_ptr<DeviceProperties> > uniqueProps;
+static vector<DeviceProperties*> props;
+
+namespace cpu
 {
-	if (!vprops.size())
+	extern Devices devices;
+}
+
+vector<DeviceProperties*>& DeviceProperties::getDeviceProperties()
+{
+	if (!uniqueProps.size())
 	{
-		vprops.resize(1);
-		vprops[0] = &props;
+		uniqueProps.resize(devices.getCount());
+		props.resize(devices.getCount());
+		for (int i = 0, e = uniqueProps.size(); i != e; i++)
+		{
+			uniqueProps[i].reset(new DeviceProperties(devices.getDevice(i)));
+			props[i] = uniqueProps[i].get();
+		}
 	}
 	
-	return vprops;
+	return props;
 }
 
+extern "C" vector<DeviceProperties*>& getDeviceProperties()
+{
+	return DeviceProperties::getDeviceProperties();
+}
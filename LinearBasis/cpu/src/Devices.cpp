@@ -1,26 +1,277 @@
 #include "Devices.h"
 #include "interpolator.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sched.h>
+#include <sstream>
+#include <string>
 
 using namespace cpu;
+using namespace std;
+
+static string readLine(const string& filename)
+{
+	ifstream file(filename.c_str());
+	string line;
+	getline(file, line);
+	return line;
+}
+
+static int readInt(const string& filename, int fallback)
+{
+	string line = readLine(filename);
+	if (line.empty()) return fallback;
+	return atoi(line.c_str());
+}
+
+// Parse CPU list in sysfs format, e.g. "0-3,8-11".
+static vector<int> parseList(const string& list)
+{
+	vector<int> result;
+	stringstream ss(list);
+	string range;
+	while (getline(ss, range, ','))
+	{
+		if (range.empty()) continue;
+		int first = atoi(range.c_str()), last = first;
+		size_t dash = range.find('-');
+		if (dash != string::npos)
+			last = atoi(range.c_str() + dash + 1);
+		for (int i = first; i <= last; i++)
+			result.push_back(i);
+	}
+	return result;
+}
+
+// Size of data or unified cache of the given level, e.g. "48K".
+static long getCacheSize(int cpu, int level)
+{
+	for (int index = 0; ; index++)
+	{
+		stringstream sdir;
+		sdir << "/sys/devices/system/cpu/cpu" << cpu << "/cache/index" << index << "/";
+		string dir = sdir.str();
+
+		int l = readInt(dir + "level", -1);
+		if (l == -1) return 0;
+		if (l != level) continue;
+
+		string type = readLine(dir + "type");
+		if (type == "Instruction") continue;
+
+		string size = readLine(dir + "size");
+		long result = atol(size.c_str());
+		if (size.find('K') != string::npos) result *= 1024;
+		if (size.find('M') != string::npos) result *= 1024 * 1024;
+		return result;
+	}
+}
+
+struct CPU
+{
+	int id, node, package, core;
+
+	bool operator<(const CPU& other) const
+	{
+		if (node != other.node) return node < other.node;
+		if (package != other.package) return package < other.package;
+		if (core != other.core) return core < other.core;
+		return id < other.id;
+	}
+};
 
 Devices::Devices()
 {
-	devices.resize(1);
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set))
+		CPU_SET(0, &set);
+
+	// NUMA node of every CPU.
+	map<int, int> nodes;
+	DIR* dir = opendir("/sys/devices/system/node");
+	if (dir)
+	{
+		for (struct dirent* entry = readdir(dir); entry; entry = readdir(dir))
+		{
+			int node;
+			if (sscanf(entry->d_name, "node%d", &node) != 1) continue;
+
+			stringstream sfilename;
+			sfilename << "/sys/devices/system/node/" << entry->d_name << "/cpulist";
+			vector<int> list = parseList(readLine(sfilename.str()));
+			for (int i = 0; i < (int)list.size(); i++)
+				nodes[list[i]] = node;
+		}
+		closedir(dir);
+	}
+
+	vector<CPU> cpus;
+	for (int i = 0; i < CPU_SETSIZE; i++)
+	{
+		if (!CPU_ISSET(i, &set)) continue;
+
+		stringstream sdir;
+		sdir << "/sys/devices/system/cpu/cpu" << i << "/topology/";
+		CPU cpu;
+		cpu.id = i;
+		cpu.node = nodes.count(i) ? nodes[i] : 0;
+		cpu.package = readInt(sdir.str() + "physical_package_id", 0);
+		cpu.core = readInt(sdir.str() + "core_id", i);
+		cpus.push_back(cpu);
+	}
+	sort(cpus.begin(), cpus.end());
+
+	enum { Node, Socket, Single, Cores } mode = Node;
+	int ncoresPerDevice = 0;
+	const char* modeValue = getenv("CPU_DEVICES");
+	if (modeValue)
+	{
+		if (!strcmp(modeValue, "node"))
+			mode = Node;
+		else if (!strcmp(modeValue, "socket"))
+			mode = Socket;
+		else if (!strcmp(modeValue, "single"))
+			mode = Single;
+		else if (atoi(modeValue) > 0)
+		{
+			mode = Cores;
+			ncoresPerDevice = atoi(modeValue);
+		}
+		else
+			cerr << "Unknown CPU_DEVICES = " << modeValue << ", using node" << endl;
+	}
+
+	// Group CPUs by key, in order of the first CPU of each group.
+	vector<int> keys(cpus.size());
+	for (int i = 0, icore = -1; i < (int)cpus.size(); i++)
+	{
+		if (!i || (cpus[i].package != cpus[i - 1].package) || (cpus[i].core != cpus[i - 1].core))
+			icore++;
+
+		switch (mode)
+		{
+		case Node : keys[i] = cpus[i].node; break;
+		case Socket : keys[i] = cpus[i].package; break;
+		case Single : keys[i] = 0; break;
+		case Cores : keys[i] = icore / ncoresPerDevice; break;
+		}
+	}
+
+	int nworkers = 0;
+	const char* nworkersValue = getenv("CPU_DEVICE_WORKERS");
+	if (nworkersValue)
+		nworkers = max(0, atoi(nworkersValue));
+
+	map<int, int> indexes;
+	for (int i = 0; i < (int)cpus.size(); i++)
+	{
+		if (!indexes.count(keys[i]))
+		{
+			int index = devices.size();
+			indexes[keys[i]] = index;
+			devices.resize(index + 1);
+
+			Device& device = devices[index];
+			device.id = index;
+			device.node = cpus[i].node;
+			device.ncores = 0;
+			for (int level = 1; level <= 3; level++)
+				device.cacheSizes[level] = getCacheSize(cpus[i].id, level);
+		}
+
+		Device& device = devices[indexes[keys[i]]];
+		if (device.cpus.empty() || (cpus[i].core != cpus[i - 1].core) || (cpus[i].package != cpus[i - 1].package))
+			device.ncores++;
+		device.cpus.push_back(cpus[i].id);
+
+		if ((int)owners.size() <= cpus[i].id)
+			owners.resize(cpus[i].id + 1, -1);
+		owners[cpus[i].id] = device.id;
+	}
+
+	if (devices.empty())
+		devices.resize(1);
+
+	for (int i = 0; i < (int)devices.size(); i++)
+	{
+		Device& device = devices[i];
+		device.available = max(1, (int)device.cpus.size());
+		if (nworkers && device.cpus.size())
+			device.pool = new WorkerPool(device.cpus, nworkers);
+	}
+}
+
+Devices::~Devices()
+{
+	for (int i = 0; i < (int)devices.size(); i++)
+		delete devices[i].pool;
+}
+
+int Devices::getCount()
+{
+	return devices.size();
+}
+
+Device* Devices::getDevice(int i)
+{
+	return &devices[i];
 }
 
+// Take a slot on the device local to the calling thread, or on any other
+// device, if the local one is full, without locks. If all devices are full,
+// oversubscribe the least loaded one, as the only CPU device used to be
+// always available to any number of threads.
 Device* Devices::tryAcquire()
 {
-	// Presuming higher level CPU thread pool is managed by TBB,
-	// the only CPU device is always available to all threads.
-	return &devices[0];
+	int first = 0;
+	int cpu = sched_getcpu();
+	if ((cpu >= 0) && (cpu < (int)owners.size()) && (owners[cpu] >= 0))
+		first = owners[cpu];
+
+	for (int i = 0, e = devices.size(); i < e; i++)
+	{
+		Device& device = devices[(first + i) % e];
+		int available = __atomic_load_n(&device.available, __ATOMIC_RELAXED);
+		while (available > 0)
+			if (__atomic_compare_exchange_n(&device.available, &available, available - 1,
+				false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+				return &device;
+	}
+
+	int least = first;
+	for (int i = 0, e = devices.size(); i < e; i++)
+	{
+		int index = (first + i) % e;
+		if (__atomic_load_n(&devices[index].available, __ATOMIC_RELAXED) >
+			__atomic_load_n(&devices[least].available, __ATOMIC_RELAXED))
+			least = index;
+	}
+
+	Device& device = devices[least];
+	__atomic_fetch_sub(&device.available, 1, __ATOMIC_ACQUIRE);
+	return &device;
 }
 
 void Devices::release(Device* device)
 {
-	// Nothing to do	
+	if (!device) return;
+
+	__atomic_fetch_add(&device->available, 1, __ATOMIC_RELEASE);
 }
 
-static Devices devices;
+namespace cpu
+{
+	Devices devices;
+}
 
 extern "C" Device* tryAcquireDevice()
 {
@@ -31,4 +282,3 @@ extern "C" void releaseDevice(Device* device)
 {
 	devices.release(device);
 }
-
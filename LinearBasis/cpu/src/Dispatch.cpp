@@ -0,0 +1,172 @@
+#include "Data.h"
+#include "ISA.h"
+
+using namespace cpu;
+
+class Device;
+
+typedef void (*InterpolateValueFunc)(
+	Device* device,
+	const int dim, const int nno,
+	const int Dof_choice, const real* x,
+	const Matrix<int>* index, const Matrix<real>* surplus,
+	real* value);
+
+typedef void (*InterpolateArrayFunc)(
+	Device* device,
+	const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const real* x,
+	const Matrix<int>* index, const Matrix<real>* surplus,
+	real* value);
+
+typedef void (*InterpolateArrayManyStatelessFunc)(
+	Device* device,
+	const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const real* x, const int ldx,
+	const Matrix<int>* index, const Matrix<real>* surplus,
+	real* value, const int ldvalue);
+
+typedef void (*InterpolateArrayManyMultistateFunc)(
+	Device* device,
+	const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const real* const* x,
+	const Matrix<int>* index, const Matrix<real>* surplus,
+	real** value);
+
+// Declare variants of kernel for all instruction sets, in order of ISA::Kind.
+#define DECLARE_VARIANTS(type, name) \
+	extern "C" void name##_scalar type; \
+	extern "C" void name##_sse42 type; \
+	extern "C" void name##_avx2 type; \
+	extern "C" void name##_avx512 type; \
+	static void (*name##_variants[]) type = { name##_scalar, name##_sse42, name##_avx2, name##_avx512 }
+
+DECLARE_VARIANTS((Device* device,
+	const int dim, const int nno,
+	const int Dof_choice, const real* x,
+	const Matrix<int>* index, const Matrix<real>* surplus,
+	real* value), LinearBasis_CPU_Generic_InterpolateValue);
+
+DECLARE_VARIANTS((Device* device,
+	const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const real* x,
+	const Matrix<int>* index, const Matrix<real>* surplus,
+	real* value), LinearBasis_CPU_Generic_InterpolateArray);
+
+DECLARE_VARIANTS((Device* device,
+	const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const real* x, const int ldx,
+	const Matrix<int>* index, const Matrix<real>* surplus,
+	real* value, const int ldvalue), LinearBasis_CPU_Generic_InterpolateArrayManyStateless);
+
+DECLARE_VARIANTS((Device* device,
+	const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const real* const* x,
+	const Matrix<int>* index, const Matrix<real>* surplus,
+	real** value), LinearBasis_CPU_Generic_InterpolateArrayManyMultistate);
+
+// Variants are selected once, at library load. Forwarding costs a single
+// indirect call per interpolation. GNU ifunc is not used, as its resolver
+// runs in the middle of relocation, where reading CPU_ISA is not safe.
+static const InterpolateValueFunc interpolateValue =
+	LinearBasis_CPU_Generic_InterpolateValue_variants[ISA::get()];
+static const InterpolateArrayFunc interpolateArray =
+	LinearBasis_CPU_Generic_InterpolateArray_variants[ISA::get()];
+static const InterpolateArrayManyStatelessFunc interpolateArrayManyStateless =
+	LinearBasis_CPU_Generic_InterpolateArrayManyStateless_variants[ISA::get()];
+static const InterpolateArrayManyMultistateFunc interpolateArrayManyMultistate =
+	LinearBasis_CPU_Generic_InterpolateArrayManyMultistate_variants[ISA::get()];
+
+void* ISA::getKernel(KernelKind kind, Kind isa)
+{
+	switch (kind)
+	{
+	case InterpolateValueKind :
+		return (void*)LinearBasis_CPU_Generic_InterpolateValue_variants[isa];
+	case InterpolateArrayKind :
+		return (void*)LinearBasis_CPU_Generic_InterpolateArray_variants[isa];
+	case InterpolateArrayManyStatelessKind :
+		return (void*)LinearBasis_CPU_Generic_InterpolateArrayManyStateless_variants[isa];
+	case InterpolateArrayManyMultistateKind :
+		return (void*)LinearBasis_CPU_Generic_InterpolateArrayManyMultistate_variants[isa];
+	}
+
+	return NULL;
+}
+
+extern "C" void LinearBasis_CPU_Generic_InterpolateValue(
+	Device* device,
+	const int dim, const int nno,
+	const int Dof_choice, const real* x,
+	const Matrix<int>* index, const Matrix<real>* surplus,
+	real* value)
+{
+	interpolateValue(device, dim, nno, Dof_choice, x, index, surplus, value);
+}
+
+extern "C" void LinearBasis_CPU_Generic_InterpolateArray(
+	Device* device,
+	const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const real* x,
+	const Matrix<int>* index, const Matrix<real>* surplus,
+	real* value)
+{
+	interpolateArray(device, dim, nno, Dof_choice_start, Dof_choice_end, x, index, surplus, value);
+}
+
+extern "C" void LinearBasis_CPU_Generic_InterpolateArrayManyStateless(
+	Device* device,
+	const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const real* x, const int ldx,
+	const Matrix<int>* index, const Matrix<real>* surplus,
+	real* value, const int ldvalue)
+{
+	interpolateArrayManyStateless(device, dim, nno, Dof_choice_start, Dof_choice_end, count, x, ldx,
+		index, surplus, value, ldvalue);
+}
+
+extern "C" void LinearBasis_CPU_Generic_InterpolateArrayManyMultistate(
+	Device* device,
+	const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const real* const* x,
+	const Matrix<int>* index, const Matrix<real>* surplus,
+	real** value)
+{
+	interpolateArrayManyMultistate(device, dim, nno, Dof_choice_start, Dof_choice_end, count, x,
+		index, surplus, value);
+}
+
+#ifdef HAVE_PRECOMPILED
+#define DECLARE_PRECOMPILED_VARIANTS(func, name) \
+	extern "C" func name##_scalar(int dim); \
+	extern "C" func name##_sse42(int dim); \
+	extern "C" func name##_avx2(int dim); \
+	extern "C" func name##_avx512(int dim); \
+	static func (*name##_variants[])(int dim) = { name##_scalar, name##_sse42, name##_avx2, name##_avx512 }
+
+DECLARE_PRECOMPILED_VARIANTS(InterpolateValueFunc, LinearBasis_CPU_Precompiled_InterpolateValue);
+DECLARE_PRECOMPILED_VARIANTS(InterpolateArrayFunc, LinearBasis_CPU_Precompiled_InterpolateArray);
+DECLARE_PRECOMPILED_VARIANTS(InterpolateArrayManyStatelessFunc, LinearBasis_CPU_Precompiled_InterpolateArrayManyStateless);
+DECLARE_PRECOMPILED_VARIANTS(InterpolateArrayManyMultistateFunc, LinearBasis_CPU_Precompiled_InterpolateArrayManyMultistate);
+
+// Bundled specializations are looked up once per dim, thus no caching here.
+extern "C" InterpolateValueFunc LinearBasis_CPU_Precompiled_InterpolateValue(int dim)
+{
+	return LinearBasis_CPU_Precompiled_InterpolateValue_variants[ISA::get()](dim);
+}
+
+extern "C" InterpolateArrayFunc LinearBasis_CPU_Precompiled_InterpolateArray(int dim)
+{
+	return LinearBasis_CPU_Precompiled_InterpolateArray_variants[ISA::get()](dim);
+}
+
+extern "C" InterpolateArrayManyStatelessFunc LinearBasis_CPU_Precompiled_InterpolateArrayManyStateless(int dim)
+{
+	return LinearBasis_CPU_Precompiled_InterpolateArrayManyStateless_variants[ISA::get()](dim);
+}
+
+extern "C" InterpolateArrayManyMultistateFunc LinearBasis_CPU_Precompiled_InterpolateArrayManyMultistate(int dim)
+{
+	return LinearBasis_CPU_Precompiled_InterpolateArrayManyMultistate_variants[ISA::get()](dim);
+}
+#endif // HAVE_PRECOMPILED
@@ -0,0 +1,79 @@
+#include "ISA.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace cpu;
+using namespace std;
+
+static const char* names[] = { "scalar", "sse42", "avx2", "avx512" };
+
+static const char* flags[] = { ISA_FLAGS_SCALAR, ISA_FLAGS_SSE42, ISA_FLAGS_AVX2, ISA_FLAGS_AVX512 };
+
+static const int vectorSizes[] = { 8, 16, 32, 64 };
+
+ISA::Kind ISA::getHost()
+{
+	static int host = -1;
+	if (host != -1) return (Kind)host;
+
+	__builtin_cpu_init();
+
+	// Variants are built with -march of the matching microarchitecture,
+	// thus the companion extensions compiler may use are checked as well.
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+		__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq") &&
+		__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		host = AVX512;
+	else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		host = AVX2;
+	else if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+		host = SSE42;
+	else
+		host = Scalar;
+
+	return (Kind)host;
+}
+
+ISA::Kind ISA::get()
+{
+	static int isa = -1;
+	if (isa != -1) return (Kind)isa;
+
+	Kind host = getHost();
+	Kind selected = host;
+
+	const char* isaValue = getenv("CPU_ISA");
+	if (isaValue)
+	{
+		int i = 0;
+		for ( ; i < Count; i++)
+			if (!strcmp(isaValue, names[i])) break;
+
+		if (i == Count)
+			cerr << "Unknown CPU_ISA = " << isaValue << ", using " << names[host] << endl;
+		else if (i > host)
+			cerr << "CPU_ISA = " << isaValue << " is not supported by host, using " << names[host] << endl;
+		else
+			selected = (Kind)i;
+	}
+
+	isa = selected;
+	return selected;
+}
+
+const char* ISA::getName(Kind isa)
+{
+	return names[isa];
+}
+
+const char* ISA::getFlags(Kind isa)
+{
+	return flags[isa];
+}
+
+int ISA::getVectorSize(Kind isa)
+{
+	return vectorSizes[isa];
+}
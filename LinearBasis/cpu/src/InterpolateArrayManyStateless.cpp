@@ -6,38 +6,72 @@
 #include "LinearBasis.h"
 #endif
 
+#include "Counters.h"
 #include "Data.h"
 
 using namespace cpu;
 
 class Device;
 
+// Size of point packed into aligned vector, padded to vector size. Only
+// kernels specialized for the dimension keep the point on stack: in generic
+// kernels DIM is the runtime dim, and the point is read in place instead.
+#if defined(DEFERRED) || defined(PRECOMPILED)
+#define XA_SIZE ((DIM + AVX_VECTOR_SIZE - 1) / AVX_VECTOR_SIZE * AVX_VECTOR_SIZE)
+#endif
+
+#if defined(PRECOMPILED)
+template<int DIM>
+static void FUNCNAME(
+#else
 extern "C" void FUNCNAME(
+#endif
 	Device* device,
 	const int dim, const int nno,
-	const int Dof_choice_start, const int Dof_choice_end, const int count, double* x,
-	const Matrix<int>* index_, const Matrix<double>* surplus_, double* value)
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const double* x, const int ldx,
+	const Matrix<int>* index_, const Matrix<double>* surplus_, double* value, const int ldvalue)
 {
 	const Matrix<int>& index = *index_;
 	const Matrix<double>& surplus = *surplus_;
 
-#ifdef HAVE_AVX
-	assert(((size_t)x % (AVX_VECTOR_SIZE * sizeof(double)) == 0) && "x vector must be sufficiently memory-aligned");
-#endif
-
 	// Index arrays shall be padded to AVX_VECTOR_SIZE-element
 	// boundary to keep up the required alignment.
 	int vdim = dim / AVX_VECTOR_SIZE;
 	if (dim % AVX_VECTOR_SIZE) vdim++;
 	vdim *= AVX_VECTOR_SIZE;
 
-	const int TotalDof = Dof_choice_end - Dof_choice_start + 1;
+	COUNTERS_ROWS_BEGIN();
+
+#ifdef HAVE_AVX
+#if defined(XA_SIZE)
+	double xa[XA_SIZE] __attribute__((aligned(AVX_VECTOR_SIZE * sizeof(double))));
+#else
+	// Lanes of the last partial vector of point.
+	const __m256i tail = _mm256_castpd_si256(_mm256_cmp_pd(_mm256_set1_pd(DIM % AVX_VECTOR_SIZE),
+		_mm256_setr_pd(0, 1, 2, 3), _CMP_GT_OQ));
+#endif
+#endif
 
+	// Points and values are apart by the given leading dimensions.
 	for (int many = 0; many < count; many++)
 	{
 		for (int b = Dof_choice_start, Dof_choice = b, e = Dof_choice_end; Dof_choice <= e; Dof_choice++)
 			value[Dof_choice - b] = 0;
 #ifdef HAVE_AVX
+#if defined(XA_SIZE)
+		// Point is copied into aligned vector with zero padding, so that x
+		// may have any alignment, and vector loads never read past its end.
+		for (int j = 0; j < DIM; j++)
+			xa[j] = x[j];
+		for (int j = DIM; j < XA_SIZE; j++)
+			xa[j] = 0;
+#else
+		// Point is read in place with unaligned loads, and its last partial
+		// vector is loaded once under mask, with zero padding, so that loads
+		// never read past its end.
+		const __m256d xtail = _mm256_maskload_pd(x + DIM / AVX_VECTOR_SIZE * AVX_VECTOR_SIZE, tail);
+#endif
+
 		const __m256d double4_0_0_0_0 = _mm256_setzero_pd();
 		const __m256d double4_1_1_1_1 = _mm256_set1_pd(1.0);
 		const __m256d sign_mask = _mm256_set1_pd(-0.);
@@ -45,7 +79,7 @@ extern "C" void FUNCNAME(
 		__m256d x4;
 #if defined(DEFERRED)
 		if (DIM <= AVX_VECTOR_SIZE)
-			x4 = _mm256_load_pd(x);
+			x4 = _mm256_load_pd(xa);
 #endif
 		for (int i = 0; i < nno; i++)
 		{
@@ -56,7 +90,11 @@ extern "C" void FUNCNAME(
 				if (DIM > AVX_VECTOR_SIZE)
 #endif
 				{
-					x4 = _mm256_load_pd(x + j);
+#if defined(XA_SIZE)
+					x4 = _mm256_load_pd(xa + j);
+#else
+					x4 = (j + AVX_VECTOR_SIZE <= DIM) ? _mm256_loadu_pd(x + j) : xtail;
+#endif
 				}
 
 				__m128i i4 = _mm_load_si128(reinterpret_cast<const __m128i*>(&index(i, j)));
@@ -69,6 +107,7 @@ extern "C" void FUNCNAME(
 				temp = _mm256_mul_pd(temp, xp);
 			}
 
+			COUNTERS_ROW_ACTIVE();
 			{
 				const __m128d pairwise_sum = _mm_mul_pd(_mm256_castpd256_pd128(temp), _mm256_extractf128_pd(temp, 1));
 				const double temps = _mm_cvtsd_f64(_mm_mul_pd(pairwise_sum,
@@ -90,6 +129,7 @@ extern "C" void FUNCNAME(
 					goto zero;
 				temp *= xp;
 			}
+			COUNTERS_ROW_ACTIVE();
 			for (int b = Dof_choice_start, Dof_choice = b, e = Dof_choice_end; Dof_choice <= e; Dof_choice++)
 				value[Dof_choice - b] += temp * surplus(i, Dof_choice);
 
@@ -97,9 +137,15 @@ extern "C" void FUNCNAME(
 		}
 #endif
 
-		// TODO pad to AVX_VECTOR_SIZE!
-		value += TotalDof;
-		x += dim;
+		value += ldvalue;
+		x += ldx;
 	}
+
+	COUNTERS_ROWS_END(CounterInterpolateArrayManyStateless, (unsigned long long)nno * count,
+		2 * vdim * sizeof(int), (Dof_choice_end - Dof_choice_start + 1) * sizeof(double));
 }
 
+#if defined(PRECOMPILED)
+#include "Precompiled.h"
+#endif
+
@@ -1,21 +1,80 @@
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <vector>
 
 #include "interpolator.h"
+#include "Coalescer.h"
+#include "Counters.h"
+#include "Deterministic.h"
+#include "Device.h"
+#include "ISA.h"
 #include "JIT.h"
+#include "KernelRegistry.h"
+#include "Profiler.h"
+#include "Recorder.h"
+#include "Strided.h"
+#include "Tracer.h"
+#include "Warmup.h"
+#include "WorkerPool.h"
 
 using namespace cpu;
 using namespace std;
 
 const Parameters& Interpolator::getParameters() const { return params; }
 
+static bool isRuntimeOptimizationEnabled(const Parameters& params)
+{
+	// Deterministic mode runs generic kernels only.
+	return params.enableRuntimeOptimization && !Deterministic::isEnabled();
+}
+
 Interpolator::Interpolator(const std::string& targetSuffix, const std::string& configFile) : 
 
 params(targetSuffix, configFile)
 
 {
-	jit = params.enableRuntimeOptimization;
+	jit = isRuntimeOptimizationEnabled(params);
+
+#ifdef HAVE_COUNTERS
+	Counters::initialize();
+#endif
+	Tracer::initialize();
+	Recorder::initialize();
+	Profiler::initialize();
+
+	// Interpolator is created on all ranks at once.
+	if (jit)
+		JIT::initialize();
+}
+
+// Get runtime-optimized kernel for the given specialization parameters.
+// Until compilation in background is finished, the generic kernel is returned.
+template<typename F>
+static inline __attribute__((always_inline)) F getKernel(
+	KernelKind kind, int dim, int count, const char* funcnameTemplate, F fallbackFunc)
+{
+	KernelRegistry::Entry* kernel = KernelRegistry::getInstance().get(kind, dim, count);
+	if (!kernel) return fallbackFunc;
+
+	F func = kernel->getFunc<F>();
+	if (func) return func;
+
+	JIT::jitCompileAsync(dim, count, funcnameTemplate, fallbackFunc, kernel->getTarget<F>());
+	return kernel->getFunc<F>();
+}
+
+// Get entry point of runtime-optimized kernel, compiling it synchronously
+// and collectively: all ranks shall call it for the same kernels.
+template<typename F>
+static void compileKernel(
+	KernelKind kind, int dim, int count, const char* funcnameTemplate, F fallbackFunc)
+{
+	KernelRegistry::Entry* kernel = KernelRegistry::getInstance().get(kind, dim, count);
+	if (!kernel) return;
+
+	__atomic_store_n(kernel->getTarget<F>(),
+		JIT::jitCompile(dim, count, funcnameTemplate, fallbackFunc, true).getFunc(), __ATOMIC_RELEASE);
 }
 
 extern "C" void LinearBasis_CPU_Generic_InterpolateValue(
@@ -23,37 +82,43 @@ extern "C" void LinearBasis_CPU_Generic_InterpolateValue(
 	const int dim, const int nno,
 	const int Dof_choice, const double* x,
 	const Matrix<int>* index, const Matrix<double>* surplus, double* value_);
-	
+
 // Interpolate a single value.
-void Interpolator::interpolate(Device* device, Data* data,
+void Interpolator::interpolate(Device* device, const Data* data,
 	const int istate, const real* x, const int Dof_choice, real& value)
 {
-	if (jit)
+	// Merge with single point calls of other threads.
+	if (Coalescer::isEnabled())
 	{
-		typedef void (*Func)(
-			Device* device,
-			const int dim, const int nno,
-			const int Dof_choice, const double* x,
-			const Matrix<int>* index, const Matrix<double>* surplus, double* value_);
+		Coalescer::interpolate(device, data, istate, x, Dof_choice, Dof_choice, &value);
+		return;
+	}
 
-		static Func LinearBasis_CPU_RuntimeOpt_InterpolateValue;
+	COUNTERS_SCOPE(CounterInterpolateValue);
+	TRACE_SCOPE("InterpolateValue");
+	PROFILE_SCOPE(CounterInterpolateValue, data->dim, data->nno, 1, 1);
 
-		if (!LinearBasis_CPU_RuntimeOpt_InterpolateValue)
-		{
-			LinearBasis_CPU_RuntimeOpt_InterpolateValue =
-				JIT::jitCompile(data->dim, "LinearBasis_CPU_RuntimeOpt_InterpolateValue_",
-				(Func)LinearBasis_CPU_Generic_InterpolateValue).getFunc();
-		}
-		
-		LinearBasis_CPU_RuntimeOpt_InterpolateValue(
-			device, data->dim, data->nno, Dof_choice, x,
-			&data->index[istate], &data->surplus[istate], &value);
+	if (Recorder::isEnabled())
+		Recorder::record(InterpolateValueKind, data->dim, istate, Dof_choice, Dof_choice, 1, x);
+
+	InterpolateValueFunc generic = (InterpolateValueFunc)LinearBasis_CPU_Generic_InterpolateValue;
+	if (data->tuned)
+		generic = (InterpolateValueFunc)ISA::getKernel(InterpolateValueKind, (ISA::Kind)data->tuning.isa);
+
+	int replica = data->getReplica(device ? device->getNode() : -1);
+
+	if (jit && (!data->tuned || data->tuning.jit))
+	{
+		InterpolateValueFunc func = getKernel(InterpolateValueKind, data->dim, 1,
+			"LinearBasis_CPU_RuntimeOpt_InterpolateValue_", generic);
+
+		func(device, data->dim, data->nno, Dof_choice, x,
+			data->getIndex(replica, istate), data->getSurplus(replica, istate), &value);
 	}
 	else
-	{			
-		LinearBasis_CPU_Generic_InterpolateValue(
-			device, data->dim, data->nno, Dof_choice, x,
-			&data->index[istate], &data->surplus[istate], &value);
+	{
+		generic(device, data->dim, data->nno, Dof_choice, x,
+			data->getIndex(replica, istate), data->getSurplus(replica, istate), &value);
 	}
 }
 
@@ -63,73 +128,165 @@ extern "C" void LinearBasis_CPU_Generic_InterpolateArray(
 	const Matrix<int>* index, const Matrix<double>* surplus, double* value);
 
 // Interpolate array of values.
-void Interpolator::interpolate(Device* device, Data* data,
+void Interpolator::interpolate(Device* device, const Data* data,
 	const int istate, const real* x, const int Dof_choice_start, const int Dof_choice_end, real* value)
 {
-	if (jit)
+	// Merge with single point calls of other threads.
+	if (Coalescer::isEnabled())
 	{
-		typedef void (*Func)(
-			Device* device, const int dim, const int nno,
-			const int Dof_choice_start, const int Dof_choice_end, const double* x,
-			const Matrix<int>* index, const Matrix<double>* surplus, double* value);
+		Coalescer::interpolate(device, data, istate, x, Dof_choice_start, Dof_choice_end, value);
+		return;
+	}
 
-		static Func LinearBasis_CPU_RuntimeOpt_InterpolateArray;
+	COUNTERS_SCOPE(CounterInterpolateArray);
+	TRACE_SCOPE("InterpolateArray");
+	PROFILE_SCOPE(CounterInterpolateArray, data->dim, data->nno, Dof_choice_end - Dof_choice_start + 1, 1);
 
-		if (!LinearBasis_CPU_RuntimeOpt_InterpolateArray)
-		{
-			LinearBasis_CPU_RuntimeOpt_InterpolateArray =
-				JIT::jitCompile(data->dim, "LinearBasis_CPU_RuntimeOpt_InterpolateArray_",
-				(Func)LinearBasis_CPU_Generic_InterpolateArray).getFunc();
-		}
-		
-		LinearBasis_CPU_RuntimeOpt_InterpolateArray(
-			device, data->dim, data->nno, Dof_choice_start, Dof_choice_end, x,
-			&data->index[istate], &data->surplus[istate], value);
+	if (Recorder::isEnabled())
+		Recorder::record(InterpolateArrayKind, data->dim, istate, Dof_choice_start, Dof_choice_end, 1, x);
+
+	InterpolateArrayFunc generic = (InterpolateArrayFunc)LinearBasis_CPU_Generic_InterpolateArray;
+	if (data->tuned)
+		generic = (InterpolateArrayFunc)ISA::getKernel(InterpolateArrayKind, (ISA::Kind)data->tuning.isa);
+
+	int replica = data->getReplica(device ? device->getNode() : -1);
+
+	if (jit && (!data->tuned || data->tuning.jit))
+	{
+		InterpolateArrayFunc func = getKernel(InterpolateArrayKind, data->dim, 1,
+			"LinearBasis_CPU_RuntimeOpt_InterpolateArray_", generic);
+
+		func(device, data->dim, data->nno, Dof_choice_start, Dof_choice_end, x,
+			data->getIndex(replica, istate), data->getSurplus(replica, istate), value);
 	}
 	else
 	{
-		LinearBasis_CPU_Generic_InterpolateArray(
-			device, data->dim, data->nno, Dof_choice_start, Dof_choice_end, x,
-			&data->index[istate], &data->surplus[istate], value);
+		generic(device, data->dim, data->nno, Dof_choice_start, Dof_choice_end, x,
+			data->getIndex(replica, istate), data->getSurplus(replica, istate), value);
 	}
 }
 
 extern "C" void LinearBasis_CPU_Generic_InterpolateArrayManyStateless(
 	Device* device, const int dim, const int nno,
-	const int Dof_choice_start, const int Dof_choice_end, const int count, const double* x_,
-	const Matrix<int>* index, const Matrix<double>* surplus, double* value);
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const double* x_, const int ldx,
+	const Matrix<int>* index, const Matrix<double>* surplus, double* value, const int ldvalue);
+
+// Stateless interpolation of many points, in parts shared between threads.
+struct StatelessJob
+{
+	Device* device;
+	int dim, nno, Dof_choice_start, Dof_choice_end;
+	int tile, chunk, count;
+	const real* x;
+	int ldx;
+	const Matrix<int>* index;
+	const Matrix<real>* surplus;
+	real* value;
+	int ldvalue;
+	InterpolateArrayManyStatelessFunc func;
+
+	// Interpolate n points starting from the given one, tile by tile.
+	// The last tile may be shorter, and runs the same kernel, as the
+	// number of points is an argument of the stateless kernel.
+	void interpolate(int first, int n) const
+	{
+		for (int i = first, end = first + n; i < end; i += tile)
+		{
+			int m = min(tile, end - i);
+
+			func(device, dim, nno, Dof_choice_start, Dof_choice_end, m, x + (size_t)i * ldx, ldx,
+				index, surplus, value + (size_t)i * ldvalue, ldvalue);
+		}
+	}
+
+	static void run(void* job_, int ichunk)
+	{
+		const StatelessJob* job = (const StatelessJob*)job_;
+		int first = ichunk * job->chunk;
+		job->interpolate(first, min(job->chunk, job->count - first));
+	}
+};
 
-// TODO
 // Interpolate multiple arrays of values, with single surplus state.
-void Interpolator::interpolate(Device* device, Data* data,
+void Interpolator::interpolate(Device* device, const Data* data,
 	const int istate, const real* x, const int Dof_choice_start, const int Dof_choice_end, const int count, real* value)
 {
-	if (jit)
-	{
-		typedef void (*Func)(
-			Device* device, const int dim, const int nno,
-			const int Dof_choice_start, const int Dof_choice_end, const int count, const double* x_,
-			const Matrix<int>* index, const Matrix<double>* surplus, double* value);
+	Strided::interpolate(device, data, istate, x, data->dim, Dof_choice_start, Dof_choice_end, count,
+		value, Dof_choice_end - Dof_choice_start + 1);
+}
 
-		static Func LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyStateless;
+// Interpolate multiple arrays of values, with single surplus state,
+// reading points and writing values apart by the given leading dimensions.
+void Strided::interpolate(Device* device, const Data* data,
+	const int istate, const real* x, const int ldx, const int Dof_choice_start, const int Dof_choice_end,
+	const int count, real* value, const int ldvalue)
+{
+	// Empty batches come from the server and async paths.
+	if (count <= 0) return;
 
-		if (!LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyStateless)
-		{
-			LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyStateless =
-				JIT::jitCompile(data->dim, count, "LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyStateless_",
-				(Func)LinearBasis_CPU_Generic_InterpolateArrayManyStateless).getFunc();
-		}
+	COUNTERS_SCOPE(CounterInterpolateArrayManyStateless);
+	TRACE_SCOPE("InterpolateArrayManyStateless");
+	PROFILE_SCOPE(CounterInterpolateArrayManyStateless, data->dim, data->nno, Dof_choice_end - Dof_choice_start + 1, count);
+
+	if (Recorder::isEnabled())
+		Recorder::record(InterpolateArrayManyStatelessKind, data->dim, istate, Dof_choice_start, Dof_choice_end, count, x, ldx);
 
-		LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyStateless(
-			device, data->dim, data->nno, Dof_choice_start, Dof_choice_end, count, x,
-			&data->index[istate], &data->surplus[istate], value);
+	InterpolateArrayManyStatelessFunc generic = (InterpolateArrayManyStatelessFunc)LinearBasis_CPU_Generic_InterpolateArrayManyStateless;
+	if (data->tuned)
+		generic = (InterpolateArrayManyStatelessFunc)ISA::getKernel(InterpolateArrayManyStatelessKind, (ISA::Kind)data->tuning.isa);
+
+	int replica = data->getReplica(device ? device->getNode() : -1);
+
+	// Points are processed in tiles of the tuned size.
+	int tile = count;
+	if (data->tuned && (data->tuning.tile < count))
+		tile = data->tuning.tile;
+
+	StatelessJob job;
+	job.device = device;
+	job.dim = data->dim;
+	job.nno = data->nno;
+	job.Dof_choice_start = Dof_choice_start;
+	job.Dof_choice_end = Dof_choice_end;
+	job.tile = tile;
+	job.chunk = count;
+	job.count = count;
+	job.x = x;
+	job.ldx = ldx;
+	job.index = data->getIndex(replica, istate);
+	job.surplus = data->getSurplus(replica, istate);
+	job.value = value;
+	job.ldvalue = ldvalue;
+
+	// Kernel is looked up once per call, rather than per tile.
+	const bool jit = isRuntimeOptimizationEnabled(Interpolator::getInstance()->getParameters());
+	job.func = generic;
+	if (jit && (!data->tuned || data->tuning.jit))
+		job.func = getKernel(InterpolateArrayManyStatelessKind, data->dim, 1,
+			"LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyStateless_", generic);
+
+	// Share points between the workers of device, if any, in chunks of
+	// whole tiles. In deterministic mode, points are cut into blocks of
+	// fixed size, whatever the number of workers is.
+	WorkerPool* pool = device ? device->getWorkerPool() : NULL;
+	if (Deterministic::isEnabled())
+	{
+		job.tile = Deterministic::getBlock();
+		job.chunk = job.tile;
 	}
-	else
+	else if (pool)
+	{
+		int ntiles = (count + tile - 1) / tile;
+		int ntilesPerChunk = (ntiles + pool->getSize() - 1) / pool->getSize();
+		job.chunk = ntilesPerChunk * tile;
+	}
+	if (pool && (count > job.chunk))
 	{
-		LinearBasis_CPU_Generic_InterpolateArrayManyStateless(
-			device, data->dim, data->nno, Dof_choice_start, Dof_choice_end, count, x,
-			&data->index[istate], &data->surplus[istate], value);
+		pool->run((count + job.chunk - 1) / job.chunk, &StatelessJob::run, &job);
+		return;
 	}
+
+	job.interpolate(0, count);
 }
 
 extern "C" void LinearBasis_CPU_Generic_InterpolateArrayManyMultistate(
@@ -138,35 +295,81 @@ extern "C" void LinearBasis_CPU_Generic_InterpolateArrayManyMultistate(
 	const Matrix<int>* index, const Matrix<double>* surplus, double** value);
 
 // Interpolate multiple arrays of values, with multiple surplus states.
-void Interpolator::interpolate(Device* device, Data* data,
+void Interpolator::interpolate(Device* device, const Data* data,
 	const real** x, const int Dof_choice_start, const int Dof_choice_end, real** value)
 {
-	if (jit)
-	{
-		typedef void (*Func)(
-			Device* device, const int dim, const int nno,
-			const int Dof_choice_start, const int Dof_choice_end, const int count, const double* const* x_,
-			const Matrix<int>* index, const Matrix<double>* surplus, double** value);
+	COUNTERS_SCOPE(CounterInterpolateArrayManyMultistate);
+	TRACE_SCOPE("InterpolateArrayManyMultistate");
+	PROFILE_SCOPE(CounterInterpolateArrayManyMultistate, data->dim, data->nno, Dof_choice_end - Dof_choice_start + 1, data->nstates);
 
-		static Func LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyMultistate;
+	if (Recorder::isEnabled())
+		Recorder::record(InterpolateArrayManyMultistateKind, data->dim, Dof_choice_start, Dof_choice_end, data->nstates, x);
 
-		if (!LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyMultistate)
-		{
-			LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyMultistate =
-				JIT::jitCompile(data->dim, data->nstates, "LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyMultistate_",
-				(Func)LinearBasis_CPU_Generic_InterpolateArrayManyMultistate).getFunc();
-		}
+	InterpolateArrayManyMultistateFunc generic = (InterpolateArrayManyMultistateFunc)LinearBasis_CPU_Generic_InterpolateArrayManyMultistate;
+	if (data->tuned)
+		generic = (InterpolateArrayManyMultistateFunc)ISA::getKernel(InterpolateArrayManyMultistateKind, (ISA::Kind)data->tuning.isa);
+
+	int replica = data->getReplica(device ? device->getNode() : -1);
+
+	if (jit && (!data->tuned || data->tuning.jit))
+	{
+		InterpolateArrayManyMultistateFunc func = getKernel(InterpolateArrayManyMultistateKind, data->dim, data->nstates,
+			"LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyMultistate_", generic);
 
-		LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyMultistate(
-			device, data->dim, data->nno, Dof_choice_start, Dof_choice_end, data->nstates, x,
-			&data->index[0], &data->surplus[0], value);
+		func(device, data->dim, data->nno, Dof_choice_start, Dof_choice_end, data->nstates, x,
+			data->getIndex(replica, 0), data->getSurplus(replica, 0), value);
 	}
 	else
 	{
-		LinearBasis_CPU_Generic_InterpolateArrayManyMultistate(
-			device, data->dim, data->nno, Dof_choice_start, Dof_choice_end, data->nstates, x,
-			&data->index[0], &data->surplus[0], value);
+		generic(device, data->dim, data->nno, Dof_choice_start, Dof_choice_end, data->nstates, x,
+			data->getIndex(replica, 0), data->getSurplus(replica, 0), value);
+	}
+}
+
+// Compile and load all kernels for the given data synchronously, and run
+// each of them once, so that neither compilation, nor page faults on kernel
+// code and data happen later, in the timed loop.
+void Warmup::run(Device* device, const Data* data, const int count)
+{
+	Interpolator* interp = Interpolator::getInstance();
+	bool jit = isRuntimeOptimizationEnabled(interp->getParameters());
+
+	if (jit && (!data->tuned || data->tuning.jit))
+	{
+		compileKernel(InterpolateValueKind, data->dim, 1,
+			"LinearBasis_CPU_RuntimeOpt_InterpolateValue_",
+			(InterpolateValueFunc)LinearBasis_CPU_Generic_InterpolateValue);
+		compileKernel(InterpolateArrayKind, data->dim, 1,
+			"LinearBasis_CPU_RuntimeOpt_InterpolateArray_",
+			(InterpolateArrayFunc)LinearBasis_CPU_Generic_InterpolateArray);
+		compileKernel(InterpolateArrayManyStatelessKind, data->dim, 1,
+			"LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyStateless_",
+			(InterpolateArrayManyStatelessFunc)LinearBasis_CPU_Generic_InterpolateArrayManyStateless);
+		compileKernel(InterpolateArrayManyMultistateKind, data->dim, data->nstates,
+			"LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyMultistate_",
+			(InterpolateArrayManyMultistateFunc)LinearBasis_CPU_Generic_InterpolateArrayManyMultistate);
 	}
+
+	// Dry run every kernel on the first loaded state.
+	int istate = find(data->loadedStates.begin(), data->loadedStates.end(), true) - data->loadedStates.begin();
+	if (istate == data->nstates) return;
+
+	// Stateless kernel runs on the given number of points.
+	Vector<real> x(max(1, count) * data->dim, 0.5);
+	Vector<real> value(max(1, count) * data->TotalDof);
+	interp->interpolate(device, data, istate, x.getData(), 0, value(0));
+	interp->interpolate(device, data, istate, x.getData(), 0, data->TotalDof - 1, value.getData());
+	interp->interpolate(device, data, istate, x.getData(), 0, data->TotalDof - 1, max(1, count), value.getData());
+
+	if (find(data->loadedStates.begin(), data->loadedStates.end(), false) != data->loadedStates.end())
+		return;
+
+	vector<Vector<real> > values(data->nstates, Vector<real>(data->TotalDof));
+	vector<const real*> xs(data->nstates, x.getData());
+	vector<real*> vs(data->nstates);
+	for (int i = 0; i < data->nstates; i++)
+		vs[i] = values[i].getData();
+	interp->interpolate(device, data, &xs[0], 0, data->TotalDof - 1, &vs[0]);
 }
 
 Interpolator* Interpolator::getInstance()
@@ -184,3 +387,17 @@ extern "C" Interpolator* getInterpolator()
 	return Interpolator::getInstance();
 }
 
+extern "C" void warmupInterpolator(Device* device, const Data* data, int count)
+{
+	Warmup::run(device, data, count);
+}
+
+
+// Interpolate many points, read from and written into slices of solver
+// arrays with the given leading dimensions, without copying them.
+extern "C" void interpolateStrided(Device* device, const Data* data, int istate,
+	const real* x, int ldx, int Dof_choice_start, int Dof_choice_end, int count, real* value, int ldvalue)
+{
+	Strided::interpolate(device, data, istate, x, ldx,
+		Dof_choice_start, Dof_choice_end, count, value, ldvalue);
+}
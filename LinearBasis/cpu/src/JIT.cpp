@@ -1,19 +1,34 @@
 #ifdef HAVE_RUNTIME_OPTIMIZATION
 
+#include "ISA.h"
 #include "JIT.h"
+#include "JITCache.h"
+#include "Counters.h"
+#include "Tracer.h"
 
+#include <errno.h>
 #include <iostream>
 #include <fstream>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mpi.h>
 #include <pthread.h>
 #include <pstreams/pstream.h>
 #include <sstream>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <string>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <vector>
 #include <unistd.h>
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
 using namespace cpu;
 using namespace std;
 
@@ -26,287 +41,702 @@ const string InterpolateArrayManyStatelessKernel::sh = INTERPOLATE_ARRAY_MANY_ST
 template<>
 const string InterpolateArrayManyMultistateKernel::sh = INTERPOLATE_ARRAY_MANY_MULTISTATE_SH;
 
-template<typename K, typename F>
-K& JIT::jitCompile(int dim, int count, const string& funcnameTemplate, F fallbackFunc)
+#ifdef HAVE_PRECOMPILED
+extern "C" InterpolateValueFunc LinearBasis_CPU_Precompiled_InterpolateValue(int dim);
+extern "C" InterpolateArrayFunc LinearBasis_CPU_Precompiled_InterpolateArray(int dim);
+extern "C" InterpolateArrayManyStatelessFunc LinearBasis_CPU_Precompiled_InterpolateArrayManyStateless(int dim);
+extern "C" InterpolateArrayManyMultistateFunc LinearBasis_CPU_Precompiled_InterpolateArrayManyMultistate(int dim);
+
+template<>
+const InterpolateValueKernel::Lookup InterpolateValueKernel::precompiled =
+	LinearBasis_CPU_Precompiled_InterpolateValue;
+template<>
+const InterpolateArrayKernel::Lookup InterpolateArrayKernel::precompiled =
+	LinearBasis_CPU_Precompiled_InterpolateArray;
+template<>
+const InterpolateArrayManyStatelessKernel::Lookup InterpolateArrayManyStatelessKernel::precompiled =
+	LinearBasis_CPU_Precompiled_InterpolateArrayManyStateless;
+template<>
+const InterpolateArrayManyMultistateKernel::Lookup InterpolateArrayManyMultistateKernel::precompiled =
+	LinearBasis_CPU_Precompiled_InterpolateArrayManyMultistate;
+#endif
+
+// Node topology for shipping compiled kernels : the rank that compiles
+// a kernel sends it to the leader of each node, and every leader writes
+// a node-local copy and forwards its filename to its node-mates.
+struct Topology
+{
+	// Private copy of the world communicator, so that kernel messages
+	// never match messages of the solver.
+	MPI_Comm world;
+
+	// Communicator of ranks sharing the same node.
+	MPI_Comm node;
+
+	// World rank of this node leader.
+	int leader;
+
+	// World ranks of all node leaders.
+	vector<int> leaders;
+
+	// Instruction set supported by all ranks: kernels compiled by one rank
+	// are shipped to all nodes, thus they must run on the oldest of them.
+	ISA::Kind isa;
+
+	// World ranks of this node ranks, indexed by node rank.
+	vector<int> locals;
+
+	// World rank of this process, cached for background compilation.
+	int rank;
+};
+
+static Topology topology;
+
+void JIT::initialize()
+{
+	static bool initialized = false;
+	if (initialized) return;
+
+	MPI_Process* process;
+	MPI_ERR_CHECK(MPI_Process_get(&process));
+	int rank = process->getRank();
+	topology.rank = rank;
+
+	MPI_ERR_CHECK(MPI_Comm_dup(MPI_COMM_WORLD, &topology.world));
+	MPI_ERR_CHECK(MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED,
+		rank, MPI_INFO_NULL, &topology.node));
+	int nodeSize = 0;
+	MPI_ERR_CHECK(MPI_Comm_size(topology.node, &nodeSize));
+	topology.locals.resize(nodeSize);
+	MPI_ERR_CHECK(MPI_Allgather(&rank, 1, MPI_INT,
+		&topology.locals[0], 1, MPI_INT, topology.node));
+	topology.leader = topology.locals[0];
+
+	vector<int> leaders(process->getSize());
+	int leader = (rank == topology.leader) ? rank : -1;
+	MPI_ERR_CHECK(MPI_Allgather(&leader, 1, MPI_INT,
+		&leaders[0], 1, MPI_INT, MPI_COMM_WORLD));
+	for (int i = 0, e = leaders.size(); i != e; i++)
+		if (leaders[i] != -1)
+			topology.leaders.push_back(leaders[i]);
+
+	int isa = ISA::get();
+	MPI_ERR_CHECK(MPI_Allreduce(MPI_IN_PLACE, &isa, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD));
+	topology.isa = (ISA::Kind)isa;
+
+	initialized = true;
+}
+
+static bool readImage(const string& filename, vector<char>& image)
+{
+	ifstream file(filename.c_str(), ios::in | ios::binary);
+	if (!file.is_open()) return false;
+
+	image.assign((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	return image.size() != 0;
+}
+
+// Write the kernel image into node-local directory, which is JIT_NODE_DIR,
+// or /dev/shm by default. Returns the node-local filename, or an empty
+// string in case of failure.
+static string writeNodeLocalImage(const string& funcname, const vector<char>& image)
+{
+	string dir = "/dev/shm";
+	const char* dirValue = getenv("JIT_NODE_DIR");
+	if (dirValue)
+		dir = dirValue;
+
+	// Filename is content-addressed, thus an existing file of the same
+	// size is the same kernel, written by one of the previous runs.
+	unsigned long long h = 14695981039346656037ULL;
+	for (size_t i = 0, e = image.size(); i != e; i++)
+	{
+		h ^= (unsigned char)image[i];
+		h *= 1099511628211ULL;
+	}
+	stringstream snodeFilename;
+	snodeFilename << dir << "/" << funcname << "_" << hex << h << ".so";
+	string nodeFilename = snodeFilename.str();
+	struct stat buffer;
+	if (!stat(nodeFilename.c_str(), &buffer) && ((size_t)buffer.st_size == image.size()))
+		return nodeFilename;
+
+	string mask = dir + "/fileXXXXXX";
+	vector<char> vtmp(mask.c_str(), mask.c_str() + mask.size() + 1);
+	int fd = mkstemp(&vtmp[0]);
+	if (fd == -1)
+	{
+		cerr << "Cannot create node-local kernel file in " << dir << endl;
+		return "";
+	}
+	for (size_t written = 0; written < image.size(); )
+	{
+		ssize_t size = write(fd, &image[written], image.size() - written);
+		if (size <= 0)
+		{
+			close(fd);
+			unlink(&vtmp[0]);
+			return "";
+		}
+		written += size;
+	}
+	close(fd);
+
+	if (rename(&vtmp[0], nodeFilename.c_str()))
+	{
+		unlink(&vtmp[0]);
+		return "";
+	}
+
+	return nodeFilename;
+}
+
+// In-memory mode (JIT_MEMFD=1) : kernels never touch any filesystem.
+// Compiler writes its output straight into an anonymous memory file,
+// which is then loaded via /proc/self/fd/N, and is closed once loaded
+// (the loaded kernel keeps the memory file mapped).
+static bool isMemoryModeEnabled()
+{
+	static int enabled = -1;
+	if (enabled != -1) return enabled;
+
+	int memfd = 0;
+	const char* memfdValue = getenv("JIT_MEMFD");
+	if (memfdValue)
+		memfd = atoi(memfdValue);
+
+	enabled = memfd;
+	return enabled;
+}
+
+// Create anonymous memory file. It is not inherited by child processes,
+// the compiler opens it through /proc of this process instead.
+static int createMemoryFile(const string& name)
+{
+	int fd = syscall(__NR_memfd_create, name.c_str(), MFD_CLOEXEC);
+	if (fd == -1)
+		cerr << "memfd_create failed: " << strerror(errno) << endl;
+	return fd;
+}
+
+// Memory files are closed once loaded, and their numbers are reused, while
+// dlopen tells libraries apart by name. Thus every memory file gets a name
+// of its own, with as many "./" components, as memory files were created
+// before it.
+static string getMemoryFilename(int fd)
+{
+	static int nfiles = 0;
+	int n = __sync_fetch_and_add(&nfiles, 1);
+
+	stringstream filename;
+	filename << "/proc/self/fd/";
+	for (int i = 0; i < n; i++)
+		filename << "./";
+	filename << fd;
+	return filename.str();
+}
+
+// Compile kernel into a new anonymous memory file, and read its image.
+// Returns the memory file name, or an empty string in case of failure.
+static string compileToMemory(const string& funcname, const string& cmd, vector<char>& image)
 {
-	map<int, K>* kernels_tls = NULL;
+	int fd = createMemoryFile(funcname);
+	if (fd == -1) return "";
 
-	// Already in TLS cache?
+	// The compiler writes into the memory file of this process.
+	// Use pipes instead of temporary files between compiler stages.
+	string filename = getMemoryFilename(fd);
 	{
-		static __thread bool kernels_init = false;
-		static __thread char kernels_a[sizeof(map<int, K>)];
-		kernels_tls = (map<int, K>*)kernels_a;
+		stringstream output;
+		output << "/proc/" << getpid() << "/fd/" << fd;
+		redi::ipstream proc(cmd + " -pipe -o " + output.str(), redi::pstreams::pstderr);
+
+		string line;
+		while (std::getline(proc.out(), line))
+			cout << line << endl;
+		while (std::getline(proc.err(), line))
+			cerr << line << endl;
+	}
+
+	struct stat buffer;
+	if (fstat(fd, &buffer) || !buffer.st_size)
+	{
+		close(fd);
+		return "";
+	}
 
-		if (!kernels_init)
+	image.resize(buffer.st_size);
+	for (size_t offset = 0; offset < image.size(); )
+	{
+		ssize_t size = pread(fd, &image[offset], image.size() - offset, offset);
+		if (size <= 0)
 		{
-			kernels_tls = new (kernels_a) map<int, K>();
-			kernels_init = true;
+			close(fd);
+			return "";
 		}
+		offset += size;
+	}
 
-		K& kernel = kernels_tls->operator[](dim);
+	return filename;
+}
 
-		// Already successfully compiled?
-		if (kernel.filename != "")
-			return kernel;
+// Write the kernel image into a new anonymous memory file.
+// Returns the memory file name, or an empty string in case of failure.
+static string writeMemoryImage(const string& funcname, const vector<char>& image)
+{
+	int fd = createMemoryFile(funcname);
+	if (fd == -1) return "";
 
-		// Already unsuccessfully compiled?
-		if (kernel.compilationFailed)
+	for (size_t written = 0; written < image.size(); )
+	{
+		ssize_t size = write(fd, &image[written], image.size() - written);
+		if (size <= 0)
 		{
-			kernel.dim = dim;
-			kernel.fileowner = false;
-			kernel.func = fallbackFunc;
+			close(fd);
+			return "";
+		}
+		written += size;
+	}
 
-			__sync_synchronize();
-	
-			return kernel;
+	return getMemoryFilename(fd);
+}
+
+// Close memory file of the kernel, once it is loaded.
+static void closeMemoryFile(const string& filename)
+{
+	const string prefix = "/proc/self/fd/";
+	if (filename.compare(0, prefix.size(), prefix)) return;
+
+	close(atoi(filename.c_str() + filename.rfind('/') + 1));
+}
+
+// Compile kernel by the calling rank alone, or find it in JIT cache.
+template<typename K>
+void JIT::compile(K& kernel, int dim, int count, const string& funcname)
+{
+	cout << "Performing deferred CPU kernel compilation for dim = " << dim <<
+		" on rank #" << topology.rank << " ..." << endl;
+
+	// Read the compile command template.
+	stringstream cmd;
+	{
+		std::ifstream t(kernel.sh.c_str());
+		std::string sh((std::istreambuf_iterator<char>(t)),
+			std::istreambuf_iterator<char>());
+		if (!t.is_open())
+		{
+			cerr << "Error opening file: " << kernel.sh << endl;
+			kernel.compilationFailed = true;
 		}
+		stringstream snewline;
+		snewline << endl;
+		string newline = snewline.str();
+		for (size_t pos = sh.find(newline); pos != string::npos; pos = sh.find(newline))
+			sh.erase(pos, newline.size());
+		cmd << sh;
+		cmd << " -DDEFERRED";
+		cmd << " -DFUNCNAME=";
+		cmd << funcname;
+		cmd << " -DDIM=";
+		cmd << dim;
+		cmd << " -DCOUNT=";
+		cmd << count;
+		cmd << " ";
+		cmd << ISA::getFlags(topology.isa);
 	}
+	//cout << cmd.str() << endl;
+
+	// Look up the kernel in persistent cache, and compile it only
+	// if not found. In memory mode, there is no cache, and kernel
+	// is always compiled. If compilation fails, we can still continue
+	// in fallback mode by executing the generic kernel.
+	string filename = "";
+	if (!kernel.compilationFailed)
+	{
+		TRACE_SCOPE("compile");
+
+		if (isMemoryModeEnabled())
+		{
+			filename = compileToMemory(funcname, cmd.str(), kernel.image);
+			if (filename == "")
+				kernel.compilationFailed = true;
+		}
+		else
+		{
+			JITCache& cache = JITCache::getInstance();
+			filename = cache.getFilename(funcname, cmd.str());
+			if (!cache.compile(cmd.str(), filename) || !readImage(filename, kernel.image))
+				kernel.compilationFailed = true;
+		}
+	}
+
+	if (kernel.compilationFailed)
+		cerr << "Deferred CPU kernel compilation failed!" << endl;
+	else
+	{
+		cout << "JIT-compiled CPU kernel for dim = " << dim << endl;
+
+		kernel.filename = filename;
+	}
+}
+
+// Messages of kernel shipping start with the kernel name, so that a kernel
+// is never taken for another one. Empty payload tells the kernel
+// compilation has failed.
+static void send(const string& funcname, const char* payload, int length, int dest, MPI_Comm comm)
+{
+	vector<char> message(funcname.c_str(), funcname.c_str() + funcname.size() + 1);
+	message.insert(message.end(), payload, payload + length);
+	MPI_ERR_CHECK(MPI_Send(&message[0], message.size(), MPI_BYTE, dest, 0, comm));
+}
+
+static void receive(const string& funcname, vector<char>& payload, int source, MPI_Comm comm)
+{
+	MPI_Status status;
+	MPI_ERR_CHECK(MPI_Probe(source, 0, comm, &status));
+	int length = 0;
+	MPI_ERR_CHECK(MPI_Get_count(&status, MPI_BYTE, &length));
+	vector<char> message(length + 1);
+	MPI_ERR_CHECK(MPI_Recv(&message[0], length, MPI_BYTE, source, 0, comm, MPI_STATUS_IGNORE));
+
+	if (funcname != &message[0])
+	{
+		cerr << "Expected CPU kernel " << funcname << ", received " << &message[0] <<
+			": collective kernel compilation shall be made by all ranks in the same order" << endl;
+		MPI_Process* process;
+		MPI_ERR_CHECK(MPI_Process_get(&process));
+		process->abort();
+	}
+
+	payload.assign(message.begin() + funcname.size() + 1, message.begin() + length);
+}
 
-	// Already in process cache?
-	static map<int, K> kernels;
+template<typename K, typename F>
+K& JIT::jitCompile(int dim, int count, const string& funcnameTemplate, F fallbackFunc, bool collective)
+{
+	// Already in process cache? Kernels are looked up here only once
+	// per specialization, on the way to KernelRegistry, hence the lock.
+	static map<pair<int, int>, K> kernels;
 
 	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
 	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
 
-	K& kernel = kernels[dim];
+	K& kernel = kernels[make_pair(dim, count)];
 
-	// Already successfully compiled?
-	if (kernel.filename != "")
+	// Already compiled, successfully or not? In collective compilation,
+	// the rank still takes its part in shipping the kernel to others.
+	bool ready = (kernel.filename != "") || kernel.compilationFailed;
+	if (ready && !collective)
 	{
-		kernels_tls->operator[](dim) = kernel;
+		if (kernel.compilationFailed)
+		{
+			kernel.dim = dim;
+			kernel.func = fallbackFunc;
+
+			__sync_synchronize();
+		}
+
 		PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
 		return kernel;
 	}
 
-	// Already unsuccessfully compiled?
-	if (kernel.compilationFailed)
+#ifdef HAVE_PRECOMPILED
+	// Kernel specialization for this dim is bundled into the library?
+	// Then no compilation is needed on any rank.
+	kernel.func = K::precompiled(dim);
+	if (kernel.func)
 	{
 		kernel.dim = dim;
-		kernel.fileowner = false;
-		kernel.func = fallbackFunc;
 
 		__sync_synchronize();
 
-		kernels_tls->operator[](dim) = kernel;
 		PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
 		return kernel;
 	}
-	
-	MPI_Process* process;
-	MPI_ERR_CHECK(MPI_Process_get(&process));
-	if (process->isMaster())
+#endif
+
+	COUNTERS_SCOPE(CounterJITCompile);
+	TRACE_SCOPE("JIT compile");
+
+	// Generate function name for specific number of arguments.
+	// Count and instruction set are also baked into the kernel, thus
+	// they are a part of the name.
+	stringstream sfuncname;
+	sfuncname << funcnameTemplate;
+	sfuncname << ISA::getName(topology.isa) << "_";
+	sfuncname << dim;
+	if (count != 1)
+		sfuncname << "_" << count;
+	string funcname = sfuncname.str();
+
+	kernel.dim = dim;
+	kernel.rank = topology.rank;
+	kernel.funcname = funcname;
+
+	// Kernels requested on demand are compiled by the calling rank, because
+	// other ranks may never request the same kernel. Ranks sharing the cache
+	// directory still compile it only once, the others find it in cache.
+	if (!collective)
 	{
-		cout << "Performing deferred CPU kernel compilation for dim = " << dim << " ..." << endl;
-
-		char* cwd = get_current_dir_name();
-		string dir = (string)cwd + "/.cache";
-		mkdir(dir.c_str(), S_IRWXU);
-		struct TempFile
-		{
-			string filename;
-
-			TempFile(const string& mask) : filename("")
-			{
-				vector<char> vfilename(mask.c_str(), mask.c_str() + mask.size() + 1);
-				int fd = mkstemp(&vfilename[0]);
-				if (fd == -1)
-					return;
-				close(fd);
-				filename = (char*)&vfilename[0];
-				bool keepCache = false;
-				const char* keepCacheValue = getenv("KEEP_CACHE");
-				if (keepCacheValue)
-					keepCache = atoi(keepCacheValue);
-				if (!keepCache)
-					unlink(filename.c_str());
-			}
-		}
-		tmp((string)cwd + "/.cache/fileXXXXXX");
-		free(cwd);
+		compile(kernel, dim, count, funcname);
 
-		if (tmp.filename == "")
-		{
-			cerr << "Deferred CPU kernel temp file creation failed!" << endl;
+		__sync_synchronize();
 
-			kernel.compilationFailed = true;
-			kernel.dim = dim;
-			kernel.fileowner = false;
+		if (!kernel.compilationFailed)
+			kernel.func = kernel.getFunc();
+		if (kernel.compilationFailed)
 			kernel.func = fallbackFunc;
+		if (isMemoryModeEnabled())
+			closeMemoryFile(kernel.filename);
+		PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+		return kernel;
+	}
 
-			__sync_synchronize();
+	MPI_Process* process;
+	MPI_ERR_CHECK(MPI_Process_get(&process));
 
-			kernels_tls->operator[](dim) = kernel;
-			PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
-			return kernel;
-		}
+	// Different kernels are compiled by different ranks.
+	int owner = hash<string>()(funcname) % process->getSize();
+	int rank = process->getRank();
+	bool leader = (rank == topology.leader);
 
-		// Generate function name for specific number of arguments.
-		stringstream sfuncname;
-		sfuncname << funcnameTemplate;
-		sfuncname << dim;
-		string funcname = sfuncname.str();
+	if (rank == owner)
+	{
+		if (!ready)
+			compile(kernel, dim, count, funcname);
+		else if (!kernel.compilationFailed && kernel.image.empty())
+			readImage(kernel.filename, kernel.image);
 
-		// Read the compile command template.
-		stringstream cmd;
+		// Ship compiled kernel to leaders of all nodes.
+		for (int i = 0, e = topology.leaders.size(); i != e; i++)
 		{
-			std::ifstream t(kernel.sh.c_str());
-			std::string sh((std::istreambuf_iterator<char>(t)),
-				std::istreambuf_iterator<char>());
-			if (!t.is_open())
-			{
-				cerr << "Error opening file: " << kernel.sh << endl;
-				cerr << "Deferred CPU kernel compilation failed!" << endl;
+			if (topology.leaders[i] == rank) continue;
 
-				kernel.compilationFailed = true;
-				kernel.dim = dim;
-				kernel.fileowner = false;
-				kernel.func = fallbackFunc;
+			send(funcname, kernel.image.size() && !kernel.compilationFailed ? &kernel.image[0] : NULL,
+				kernel.compilationFailed ? 0 : kernel.image.size(), topology.leaders[i], topology.world);
+		}
 
-				__sync_synchronize();
+		// Node leader loads the node-local copy, just like its node-mates.
+		if (!ready && leader && !kernel.compilationFailed && !isMemoryModeEnabled())
+			kernel.filename = writeNodeLocalImage(funcname, kernel.image);
+	}
+	else if (leader)
+	{
+		// Receive compiled kernel from its owner.
+		Tracer::Scope traceWait("wait for kernel");
+		vector<char> image;
+		receive(funcname, image, owner, topology.world);
+		traceWait.end();
 
-				kernels_tls->operator[](dim) = kernel;
-				PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
-				return kernel;
+		if (!ready)
+		{
+			kernel.image.swap(image);
+			if (kernel.image.empty())
+				kernel.compilationFailed = true;
+			else
+			{
+				if (isMemoryModeEnabled())
+					kernel.filename = writeMemoryImage(funcname, kernel.image);
+				else
+					kernel.filename = writeNodeLocalImage(funcname, kernel.image);
+				if (kernel.filename == "")
+					kernel.compilationFailed = true;
 			}
-			stringstream snewline;
-			snewline << endl;
-			string newline = snewline.str();
-			for (int pos = sh.find(newline); pos != string::npos; pos = sh.find(newline))
-				sh.erase(pos, newline.size());
-			cmd << sh;
-			cmd << " -DDEFERRED";
-			cmd << " -DFUNCNAME=";
-			cmd << funcname;
-			cmd << " -DDIM=";
-			cmd << dim;
-			cmd << " -DCOUNT=";
-			cmd << count;
-	
-			cmd << " -o ";
-			cmd << tmp.filename;
 		}
-		//cout << cmd.str() << endl;
+	}
 
-		// Run compiler as a process and create a streambuf that
-		// reads its stdout and stderr.
+	if (leader)
+	{
+		// Forward node-local kernel filename to node-mates. Memory files
+		// are private to the process, so in memory mode the whole kernel
+		// image is forwarded instead.
+		const char* message = kernel.filename.c_str();
+		int length = kernel.filename.size();
+		if (isMemoryModeEnabled())
 		{
-			redi::ipstream proc(cmd.str(), redi::pstreams::pstderr);
-
-			string line;
-			while (std::getline(proc.out(), line))
-				cout << line << endl;
-			while (std::getline(proc.err(), line))
-				cerr << line << endl;
+			message = kernel.image.size() ? &kernel.image[0] : NULL;
+			length = kernel.image.size();
 		}
-
-		// If the output file does not exist, there must be some
-		// fatal error. However, we can still continue in fallback
-		// mode by executing the generic kernel.
-		struct stat buffer;
-		if (stat(tmp.filename.c_str(), &buffer))
+		if (kernel.compilationFailed)
 		{
-			cerr << "Deferred CPU kernel compilation failed!" << endl;
-
-			kernel.compilationFailed = true;
-			kernel.dim = dim;
-			kernel.fileowner = false;
-			kernel.func = fallbackFunc;
-
-			__sync_synchronize();
-
-			kernels_tls->operator[](dim) = kernel;
-			PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
-			return kernel;
+			message = NULL;
+			length = 0;
 		}
 
-		cout << "JIT-compiled CPU kernel for dim = " << dim << endl;
-
-		kernel.dim = dim;
-		kernel.filename = tmp.filename;
-		kernel.fileowner = true;
-		kernel.funcname = funcname;
-
-		__sync_synchronize();
-
-		// Send filename to everyone.
-		static vector<MPI_Request> vrequests;
-		vrequests.resize(vrequests.size() + process->getSize() * 2);
-		MPI_Request* requests = &vrequests[vrequests.size() - 1 - process->getSize() * 2];
-		for (int i = 0, e = process->getSize(); i != e; i++)
+		for (int i = 0, e = topology.locals.size(); i != e; i++)
 		{
-			if (i == process->getRoot()) continue;
+			if ((topology.locals[i] == rank) || (topology.locals[i] == owner)) continue;
 
-			int length = tmp.filename.length();
-			MPI_ERR_CHECK(MPI_Isend(&length,
-				1, MPI_INT, i, ((int)(size_t)&JIT::jitCompile<K, F>) % 32767, MPI_COMM_WORLD, &requests[2 * i]));
-			MPI_ERR_CHECK(MPI_Isend((void*)tmp.filename.c_str(), tmp.filename.length(),
-				MPI_BYTE, i, ((int)(size_t)&JIT::jitCompile<K, F> + 1) % 32767, MPI_COMM_WORLD, &requests[2 * i + 1]));
+			send(funcname, message, length, i, topology.node);
 		}
-		/*for (int i = 0, e = requests.size(); i != e; i++)
-		{
-			if (i == 2 * process->getRoot()) continue;
-			if (i == 2 * process->getRoot() + 1) continue;
-			MPI_ERR_CHECK(MPI_Wait(&requests[i], MPI_STATUS_IGNORE));
-		}*/
 	}
-	else
+	else if (rank != owner)
 	{
-		// Generate function name for specific number of arguments.
-		stringstream sfuncname;
-		sfuncname << funcnameTemplate;
-		sfuncname << dim;
-		string funcname = sfuncname.str();
-
-		// Receive filename from master.
-		int length = 0;
-		MPI_ERR_CHECK(MPI_Recv(&length, 1, MPI_INT,
-			process->getRoot(), ((int)(size_t)&JIT::jitCompile<K, F>) % 32767, MPI_COMM_WORLD, MPI_STATUS_IGNORE));
+		// Receive node-local kernel filename (or image) from node leader.
+		Tracer::Scope traceWait("wait for filename");
 		vector<char> buffer;
-		buffer.resize(length);
-		MPI_ERR_CHECK(MPI_Recv(&buffer[0], length, MPI_BYTE,
-			process->getRoot(), ((int)(size_t)&JIT::jitCompile<K, F> + 1) % 32767, MPI_COMM_WORLD, MPI_STATUS_IGNORE));
+		receive(funcname, buffer, 0, topology.node);
+		traceWait.end();
 
-		kernel.dim = dim;
-		kernel.filename = string(&buffer[0], buffer.size());
-		kernel.fileowner = false;
-		kernel.funcname = funcname;
-		
-		__sync_synchronize();
+		if (!ready)
+		{
+			if (buffer.empty())
+				kernel.compilationFailed = true;
+			else if (isMemoryModeEnabled())
+			{
+				kernel.filename = writeMemoryImage(funcname, buffer);
+				if (kernel.filename == "")
+					kernel.compilationFailed = true;
+			}
+			else
+				kernel.filename = string(&buffer[0], buffer.size());
+		}
 	}
 
-	kernel.func = kernel.getFunc();
-	kernels_tls->operator[](dim) = kernel;
+	__sync_synchronize();
+
+	if (!kernel.compilationFailed)
+		kernel.func = kernel.getFunc();
+	if (kernel.compilationFailed)
+		kernel.func = fallbackFunc;
+	if (!ready && isMemoryModeEnabled())
+		closeMemoryFile(kernel.filename);
 	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
 	return kernel;
 }
 
+static bool isAsyncEnabled()
+{
+	static int enabled = -1;
+	if (enabled != -1) return enabled;
+
+	// Kernels compiled in background are never shipped between ranks,
+	// and compilation and loading use the rank cached by initialize,
+	// thus background threads make no MPI calls, and no thread support
+	// is needed from MPI library.
+	int async = 1;
+	const char* asyncValue = getenv("JIT_ASYNC");
+	if (asyncValue)
+		async = atoi(asyncValue);
+
+	enabled = async;
+	return enabled;
+}
+
+template<typename K, typename F>
+struct AsyncCompilation
+{
+	int dim, count;
+	string funcnameTemplate;
+	F fallbackFunc;
+	F* target;
+
+	static void* run(void* arg)
+	{
+		unique_ptr<AsyncCompilation> args((AsyncCompilation*)arg);
+
+		F func = JIT::jitCompile<K, F>(args->dim, args->count,
+			args->funcnameTemplate, args->fallbackFunc).getFunc();
+		__atomic_store_n(args->target, func, __ATOMIC_RELEASE);
+
+		return NULL;
+	}
+};
+
+template<typename K, typename F>
+void JIT::jitCompileAsync(int dim, int count, const string& funcnameTemplate, F fallbackFunc, F* target)
+{
+	// Only the first caller starts compilation, others keep
+	// using the fallback function until it is replaced.
+	if (!__sync_bool_compare_and_swap(target, (F)NULL, fallbackFunc))
+		return;
+
+	if (!isAsyncEnabled())
+	{
+		F func = JIT::jitCompile<K, F>(dim, count, funcnameTemplate, fallbackFunc).getFunc();
+		__atomic_store_n(target, func, __ATOMIC_RELEASE);
+		return;
+	}
+
+	AsyncCompilation<K, F>* args = new AsyncCompilation<K, F>();
+	args->dim = dim;
+	args->count = count;
+	args->funcnameTemplate = funcnameTemplate;
+	args->fallbackFunc = fallbackFunc;
+	args->target = target;
+
+	pthread_attr_t attr;
+	PTHREAD_ERR_CHECK(pthread_attr_init(&attr));
+	PTHREAD_ERR_CHECK(pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED));
+	pthread_t thread;
+	int err = pthread_create(&thread, &attr, &AsyncCompilation<K, F>::run, args);
+	PTHREAD_ERR_CHECK(pthread_attr_destroy(&attr));
+	if (err)
+	{
+		// Unable to start a thread: compile synchronously then.
+		AsyncCompilation<K, F>::run(args);
+	}
+}
+
 InterpolateValueKernel& JIT::jitCompile(
-	int dim, const string& funcnameTemplate, InterpolateValueFunc fallbackFunc)
+	int dim, int count, const string& funcnameTemplate, InterpolateValueFunc fallbackFunc, bool collective)
 {
 	return JIT::jitCompile<InterpolateValueKernel, InterpolateValueFunc>(
-		dim, 1, funcnameTemplate, fallbackFunc);
+		dim, count, funcnameTemplate, fallbackFunc, collective);
 }
 
 InterpolateArrayKernel& JIT::jitCompile(
-	int dim, const string& funcnameTemplate, InterpolateArrayFunc fallbackFunc)
+	int dim, int count, const string& funcnameTemplate, InterpolateArrayFunc fallbackFunc, bool collective)
 {
 	return JIT::jitCompile<InterpolateArrayKernel, InterpolateArrayFunc>(
-		dim, 1, funcnameTemplate, fallbackFunc);
+		dim, count, funcnameTemplate, fallbackFunc, collective);
 }
 
 InterpolateArrayManyStatelessKernel& JIT::jitCompile(
-	int dim, int count, const string& funcnameTemplate, InterpolateArrayManyStatelessFunc fallbackFunc)
+	int dim, int count, const string& funcnameTemplate, InterpolateArrayManyStatelessFunc fallbackFunc, bool collective)
 {
 	return JIT::jitCompile<InterpolateArrayManyStatelessKernel, InterpolateArrayManyStatelessFunc>(
-		dim, count, funcnameTemplate, fallbackFunc);
+		dim, count, funcnameTemplate, fallbackFunc, collective);
 }
 
 InterpolateArrayManyMultistateKernel& JIT::jitCompile(
-	int dim, int count, const string& funcnameTemplate, InterpolateArrayManyMultistateFunc fallbackFunc)
+	int dim, int count, const string& funcnameTemplate, InterpolateArrayManyMultistateFunc fallbackFunc, bool collective)
 {
 	return JIT::jitCompile<InterpolateArrayManyMultistateKernel, InterpolateArrayManyMultistateFunc>(
-		dim, count, funcnameTemplate, fallbackFunc);
+		dim, count, funcnameTemplate, fallbackFunc, collective);
+}
+
+void JIT::jitCompileAsync(
+	int dim, int count, const string& funcnameTemplate, InterpolateValueFunc fallbackFunc,
+	InterpolateValueFunc* target)
+{
+	JIT::jitCompileAsync<InterpolateValueKernel, InterpolateValueFunc>(
+		dim, count, funcnameTemplate, fallbackFunc, target);
+}
+
+void JIT::jitCompileAsync(
+	int dim, int count, const string& funcnameTemplate, InterpolateArrayFunc fallbackFunc,
+	InterpolateArrayFunc* target)
+{
+	JIT::jitCompileAsync<InterpolateArrayKernel, InterpolateArrayFunc>(
+		dim, count, funcnameTemplate, fallbackFunc, target);
+}
+
+void JIT::jitCompileAsync(
+	int dim, int count, const string& funcnameTemplate, InterpolateArrayManyStatelessFunc fallbackFunc,
+	InterpolateArrayManyStatelessFunc* target)
+{
+	JIT::jitCompileAsync<InterpolateArrayManyStatelessKernel, InterpolateArrayManyStatelessFunc>(
+		dim, count, funcnameTemplate, fallbackFunc, target);
+}
+
+void JIT::jitCompileAsync(
+	int dim, int count, const string& funcnameTemplate, InterpolateArrayManyMultistateFunc fallbackFunc,
+	InterpolateArrayManyMultistateFunc* target)
+{
+	JIT::jitCompileAsync<InterpolateArrayManyMultistateKernel, InterpolateArrayManyMultistateFunc>(
+		dim, count, funcnameTemplate, fallbackFunc, target);
 }
 
 #endif // HAVE_RUNTIME_OPTIMIZATION
@@ -0,0 +1,377 @@
+#ifdef HAVE_RUNTIME_OPTIMIZATION
+
+#include "check.h"
+#include "JITCache.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <pstreams/pstream.h>
+#include <pthread.h>
+#include <sstream>
+#include <string>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <vector>
+
+using namespace cpu;
+using namespace std;
+
+// 64-bit FNV-1a hash.
+static void fnv1a(unsigned long long& h, const string& str)
+{
+	for (int i = 0, e = str.size(); i != e; i++)
+	{
+		h ^= (unsigned char)str[i];
+		h *= 1099511628211ULL;
+	}
+}
+
+// Run the command and return everything it has written into stdout.
+static string run(const string& cmd)
+{
+	redi::ipstream proc(cmd, redi::pstreams::pstdout);
+	string result((istreambuf_iterator<char>(proc.out())), istreambuf_iterator<char>());
+	return result;
+}
+
+// Lock the file exclusively, creating it, if necessary.
+class FileLock
+{
+	int fd;
+
+public :
+
+	FileLock(const string& filename)
+	{
+		fd = open(filename.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+		if (fd != -1)
+		{
+			while (flock(fd, LOCK_EX) == -1)
+				if (errno != EINTR)
+				{
+					close(fd);
+					fd = -1;
+					break;
+				}
+		}
+	}
+
+	bool isLocked() const { return fd != -1; }
+
+	~FileLock()
+	{
+		if (fd == -1) return;
+		flock(fd, LOCK_UN);
+		close(fd);
+	}
+};
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Split compile command "cd <dir> && <compiler> <flags>" into its parts.
+static void parseCommand(const string& cmd, string& dir, string& compiler, vector<string>& args)
+{
+	string line = cmd;
+	size_t pos = line.find("&&");
+	if (pos != string::npos)
+	{
+		istringstream iss(line.substr(0, pos));
+		string cd;
+		iss >> cd >> dir;
+		line = line.substr(pos + 2);
+	}
+
+	istringstream iss(line);
+	iss >> compiler;
+	for (string arg; iss >> arg; )
+		args.push_back(arg);
+}
+
+string JITCache::getCompilerVersion(const string& cmd)
+{
+	string dir, compiler;
+	vector<string> args;
+	parseCommand(cmd, dir, compiler, args);
+
+	// Compiler is run only once per process.
+	static map<string, string> versions;
+
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+	map<string, string>::iterator i = versions.find(compiler);
+	if (i == versions.end())
+		i = versions.insert(make_pair(compiler, run(compiler + " --version 2>&1"))).first;
+	string version = i->second;
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+
+	return version;
+}
+
+string JITCache::getHostISA()
+{
+	static string isa = "";
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+	if (isa == "")
+	{
+		ifstream cpuinfo("/proc/cpuinfo");
+		string line;
+		while (getline(cpuinfo, line))
+		{
+			if (line.compare(0, 5, "flags")) continue;
+
+			isa = line;
+			break;
+		}
+
+		if (isa == "") isa = "unknown";
+	}
+	string result = isa;
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+
+	return result;
+}
+
+string JITCache::getSourceStamp(const string& cmd)
+{
+	string dir, compiler;
+	vector<string> args;
+	parseCommand(cmd, dir, compiler, args);
+
+	// Kernel sources are hashed by contents, which is cheaper than
+	// preprocessing them, and needs no process to be run.
+	unsigned long long h = 14695981039346656037ULL;
+	for (int i = 0, e = args.size(); i != e; i++)
+	{
+		const string& arg = args[i];
+		if ((arg.size() < 4) || arg.compare(arg.size() - 4, 4, ".cpp"))
+			continue;
+
+		string filename = ((arg[0] == '/') || (dir == "")) ? arg : dir + "/" + arg;
+		ifstream file(filename.c_str(), ios::in | ios::binary);
+		fnv1a(h, string((istreambuf_iterator<char>(file)), istreambuf_iterator<char>()));
+	}
+
+	// Headers shared by kernels and the library are compiled into the
+	// library as well, thus they are accounted by the library build.
+	static string library = "";
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+	if (library == "")
+	{
+		stringstream slibrary;
+		Dl_info info;
+		struct stat buffer;
+		if (dladdr((void*)&JITCache::getInstance, &info) && info.dli_fname &&
+			!stat(info.dli_fname, &buffer))
+			slibrary << info.dli_fname << " " << buffer.st_size << " " << buffer.st_mtime;
+		else
+			slibrary << "unknown";
+		library = slibrary.str();
+	}
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+	fnv1a(h, library);
+
+	stringstream stamp;
+	stamp << hex << h;
+	return stamp.str();
+}
+
+JITCache::JITCache()
+{
+	const char* dirValue = getenv("JIT_CACHE_DIR");
+	if (dirValue)
+		dir = dirValue;
+	else
+	{
+		char* cwd = get_current_dir_name();
+		dir = (string)cwd + "/.cache";
+		free(cwd);
+	}
+
+	int maxSizeMB = 1024;
+	const char* maxSizeValue = getenv("JIT_CACHE_SIZE_MB");
+	if (maxSizeValue)
+	{
+		if (atoi(maxSizeValue) >= 0)
+			maxSizeMB = atoi(maxSizeValue);
+		else
+			cerr << "Invalid JIT_CACHE_SIZE_MB = " << maxSizeValue << ", using " << maxSizeMB << endl;
+	}
+	maxSize = (size_t)maxSizeMB * 1024 * 1024;
+
+	mkdir(dir.c_str(), S_IRWXU);
+}
+
+const string& JITCache::getDirectory() const { return dir; }
+
+string JITCache::getFilename(const string& funcname, const string& cmd) const
+{
+	unsigned long long h = 14695981039346656037ULL;
+	fnv1a(h, cmd);
+	fnv1a(h, getSourceStamp(cmd));
+	fnv1a(h, getCompilerVersion(cmd));
+	fnv1a(h, getHostISA());
+
+	stringstream filename;
+	filename << dir << "/" << funcname << "_" << hex << h << ".so";
+	return filename.str();
+}
+
+bool JITCache::compile(const string& cmd, const string& filename)
+{
+	// Serialize compilation of the same kernel between processes.
+	FileLock lock(filename + ".lock");
+	if (!lock.isLocked())
+	{
+		cerr << "Cannot lock JIT cache entry " << filename << endl;
+		return false;
+	}
+
+	// Already compiled by someone else?
+	struct stat buffer;
+	if (!stat(filename.c_str(), &buffer))
+	{
+		// Mark as recently used.
+		utime(filename.c_str(), NULL);
+		return true;
+	}
+
+	// Compile into a temporary file and rename it, so that other
+	// processes never observe a partially written shared object.
+	string mask = dir + "/fileXXXXXX";
+	vector<char> vtmp(mask.c_str(), mask.c_str() + mask.size() + 1);
+	int fd = mkstemp(&vtmp[0]);
+	if (fd == -1)
+	{
+		cerr << "Deferred CPU kernel temp file creation failed!" << endl;
+		return false;
+	}
+	close(fd);
+	string tmp = &vtmp[0];
+
+	// Run compiler as a process and create a streambuf that
+	// reads its stdout and stderr.
+	{
+		redi::ipstream proc(cmd + " -o " + tmp, redi::pstreams::pstderr);
+
+		string line;
+		while (std::getline(proc.out(), line))
+			cout << line << endl;
+		while (std::getline(proc.err(), line))
+			cerr << line << endl;
+	}
+
+	// If the output file is empty, there must be some fatal error.
+	if (stat(tmp.c_str(), &buffer) || !buffer.st_size)
+	{
+		unlink(tmp.c_str());
+		return false;
+	}
+
+	if (rename(tmp.c_str(), filename.c_str()))
+	{
+		unlink(tmp.c_str());
+		return false;
+	}
+
+	trim(filename);
+
+	return true;
+}
+
+// Entries are never evicted, until they are that old (in seconds): a kernel
+// just compiled or used by another process is likely not loaded by it yet.
+static const time_t gracePeriod = 60;
+
+void JITCache::trim(const string& keep)
+{
+	// Serialize eviction between processes.
+	FileLock lock(dir + "/.lock");
+	if (!lock.isLocked()) return;
+
+	struct Entry
+	{
+		string filename;
+		off_t size;
+		time_t mtime;
+
+		bool operator<(const Entry& other) const { return mtime < other.mtime; }
+	};
+
+	DIR* d = opendir(dir.c_str());
+	if (!d) return;
+
+	time_t now = time(NULL);
+	vector<Entry> entries;
+	vector<string> locks;
+	size_t size = 0;
+	for (struct dirent* ent = readdir(d); ent; ent = readdir(d))
+	{
+		string name = ent->d_name;
+		if ((name.size() > 8) && !name.compare(name.size() - 8, 8, ".so.lock"))
+		{
+			locks.push_back(dir + "/" + name);
+			continue;
+		}
+		if ((name.size() < 3) || name.compare(name.size() - 3, 3, ".so"))
+			continue;
+
+		Entry entry;
+		entry.filename = dir + "/" + name;
+		struct stat buffer;
+		if (stat(entry.filename.c_str(), &buffer))
+			continue;
+		entry.size = buffer.st_size;
+		entry.mtime = buffer.st_mtime;
+		entries.push_back(entry);
+		size += entry.size;
+	}
+	closedir(d);
+
+	// Locks of entries, which are gone, are removed as well. Should a process
+	// still hold a removed lock, the worst case is the same kernel compiled
+	// twice, which is harmless, as entries are replaced atomically.
+	for (int i = 0, e = locks.size(); i != e; i++)
+	{
+		struct stat buffer;
+		string filename = locks[i].substr(0, locks[i].size() - 5);
+		if (!stat(filename.c_str(), &buffer) || stat(locks[i].c_str(), &buffer) ||
+			(now - buffer.st_mtime < gracePeriod))
+			continue;
+
+		unlink(locks[i].c_str());
+	}
+
+	if (size <= maxSize) return;
+
+	// Unlinking a shared object already loaded by another process
+	// is safe: its mapping remains valid until dlclose.
+	sort(entries.begin(), entries.end());
+	for (int i = 0, e = entries.size(); (i != e) && (size > maxSize); i++)
+	{
+		if (entries[i].filename == keep) continue;
+		if (now - entries[i].mtime < gracePeriod) break;
+
+		unlink(entries[i].filename.c_str());
+		unlink((entries[i].filename + ".lock").c_str());
+		size -= entries[i].size;
+	}
+}
+
+JITCache& JITCache::getInstance()
+{
+	static JITCache cache;
+	return cache;
+}
+
+#endif // HAVE_RUNTIME_OPTIMIZATION
+
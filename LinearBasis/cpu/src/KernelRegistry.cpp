@@ -0,0 +1,51 @@
+#include "KernelRegistry.h"
+
+using namespace cpu;
+
+unsigned long long KernelRegistry::getKey(KernelKind kind, int dim, int count)
+{
+	// Key layout : 1 | kind (7 bits) | dim (28 bits) | count (28 bits).
+	// The highest bit is always set, as zero key marks an empty entry.
+	return (1ULL << 63) |
+		((unsigned long long)(kind & 0x7f) << 56) |
+		((unsigned long long)(dim & 0xfffffff) << 28) |
+		(unsigned long long)(count & 0xfffffff);
+}
+
+KernelRegistry::Entry* KernelRegistry::get(unsigned long long key)
+{
+	// Mix key bits for better distribution across entries.
+	unsigned long long h = key;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+
+	for (int i = 0; i < capacity; i++)
+	{
+		Entry& entry = entries[(h + i) & (capacity - 1)];
+
+		unsigned long long current = __atomic_load_n(&entry.key, __ATOMIC_ACQUIRE);
+		if (current == key)
+			return &entry;
+
+		// Try to occupy an empty entry. If someone else has just taken it,
+		// it still could be taken for the same key.
+		if (!current)
+		{
+			if (__sync_bool_compare_and_swap(&entry.key, 0ULL, key))
+				return &entry;
+			if (__atomic_load_n(&entry.key, __ATOMIC_ACQUIRE) == key)
+				return &entry;
+		}
+	}
+
+	return NULL;
+}
+
+KernelRegistry& KernelRegistry::getInstance()
+{
+	// Zero-initialized statically, thus safe to be used by any thread.
+	static KernelRegistry registry;
+	return registry;
+}
+
@@ -0,0 +1,176 @@
+#include "check.h"
+#include "Memory.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+using namespace cpu;
+using namespace std;
+
+enum Pages { PagesNone, PagesTHP, Pages2M, Pages1G };
+
+static const size_t hugePageSize = 2 * 1024 * 1024;
+
+static Pages getPages()
+{
+	static int pages = -1;
+	if (pages != -1) return (Pages)pages;
+
+	pages = PagesTHP;
+	const char* pagesValue = getenv("HUGEPAGES");
+	if (pagesValue)
+	{
+		if (!strcmp(pagesValue, "none"))
+			pages = PagesNone;
+		else if (!strcmp(pagesValue, "thp"))
+			pages = PagesTHP;
+		else if (!strcmp(pagesValue, "2M"))
+			pages = Pages2M;
+		else if (!strcmp(pagesValue, "1G"))
+			pages = Pages1G;
+		else
+			cerr << "Unknown HUGEPAGES = " << pagesValue << ", using thp" << endl;
+	}
+
+	return (Pages)pages;
+}
+
+struct Mapping
+{
+	size_t length;
+	size_t page;
+};
+
+// Length and page size of every mapping, by address.
+static map<void*, Mapping> mappings;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void warnOnce(bool& warned, const char* message)
+{
+	if (warned) return;
+
+	cerr << message << ": " << strerror(errno) << endl;
+	warned = true;
+}
+
+void* Memory::allocate(size_t size, size_t alignment)
+{
+	if ((size < hugePageSize) || (alignment > hugePageSize)) return NULL;
+
+	Pages pages = getPages();
+	static bool prefault = (getenv("DATA_PREFAULT") != NULL);
+	static bool lock = (getenv("DATA_MLOCK") != NULL);
+
+	void* ptr = MAP_FAILED;
+	size_t length = 0, page = sysconf(_SC_PAGESIZE);
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	if (prefault) flags |= MAP_POPULATE;
+
+	if ((pages == Pages2M) || (pages == Pages1G))
+	{
+		size_t hugePage = (pages == Pages2M) ? hugePageSize : 1024 * 1024 * 1024;
+		length = (size + hugePage - 1) / hugePage * hugePage;
+		ptr = mmap(NULL, length, PROT_READ | PROT_WRITE,
+			flags | MAP_HUGETLB | (((pages == Pages2M) ? 21 : 30) << MAP_HUGE_SHIFT), -1, 0);
+
+		static bool warned = false;
+		if (ptr == MAP_FAILED)
+			warnOnce(warned, "Cannot allocate explicit huge pages, using transparent huge pages");
+		else
+			page = hugePage;
+	}
+
+	if (ptr == MAP_FAILED)
+	{
+		// Align to huge page, so that the whole range can be backed by
+		// transparent huge pages, and trim the excess.
+		length = (size + hugePageSize - 1) / hugePageSize * hugePageSize;
+		size_t excess = length + hugePageSize;
+		char* base = (char*)mmap(NULL, excess, PROT_READ | PROT_WRITE,
+			(pages == PagesNone) ? flags : (flags & ~MAP_POPULATE), -1, 0);
+		if (base == MAP_FAILED) return NULL;
+
+		char* aligned = (char*)(((size_t)base + hugePageSize - 1) / hugePageSize * hugePageSize);
+		if (aligned != base)
+			munmap(base, aligned - base);
+		if (aligned + length != base + excess)
+			munmap(aligned + length, base + excess - (aligned + length));
+		ptr = aligned;
+
+		if (pages != PagesNone)
+		{
+			// Pages must be advised before they are touched.
+			madvise(ptr, length, MADV_HUGEPAGE);
+			if (prefault)
+			{
+				bool populated = false;
+#ifdef MADV_POPULATE_WRITE
+				populated = !madvise(ptr, length, MADV_POPULATE_WRITE);
+#endif
+				if (!populated)
+					for (size_t i = 0; i < length; i += 4096)
+						((volatile char*)ptr)[i] = 0;
+			}
+		}
+	}
+
+	if (lock && mlock(ptr, length))
+	{
+		static bool warned = false;
+		warnOnce(warned, "Cannot lock data in memory");
+	}
+
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+	Mapping& mapping = mappings[ptr];
+	mapping.length = length;
+	mapping.page = page;
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+
+	return ptr;
+}
+
+bool Memory::deallocate(void* ptr, size_t size)
+{
+	if (size < hugePageSize) return false;
+
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+	map<void*, Mapping>::iterator mapping = mappings.find(ptr);
+	if (mapping == mappings.end())
+	{
+		PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+		return false;
+	}
+	size_t length = mapping->second.length;
+	mappings.erase(mapping);
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+
+	munmap(ptr, length);
+	return true;
+}
+
+size_t Memory::getPageSize(const void* ptr)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+	map<void*, Mapping>::iterator mapping = mappings.upper_bound((void*)ptr);
+	if (mapping != mappings.begin())
+	{
+		mapping--;
+		if ((const char*)ptr < (const char*)mapping->first + mapping->second.length)
+			page = mapping->second.page;
+	}
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+
+	return page;
+}
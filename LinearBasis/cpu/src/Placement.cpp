@@ -0,0 +1,241 @@
+#include "Data.h"
+#include "Memory.h"
+#include "Placement.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace cpu;
+using namespace std;
+
+// From <numaif.h>, which comes with libnuma.
+#define MPOL_BIND 2
+#define MPOL_INTERLEAVE 3
+#define MPOL_MF_MOVE (1 << 1)
+
+#define MAX_NODES 1024
+
+static const char* names[] = { "local", "interleave", "partition", "replicate" };
+
+Placement::Policy Placement::getDefault()
+{
+	static int policy = -1;
+	if (policy != -1) return (Policy)policy;
+
+	policy = Local;
+	const char* policyValue = getenv("DATA_PLACEMENT");
+	if (policyValue)
+	{
+		int i = 0;
+		for ( ; i < Count; i++)
+			if (!strcmp(policyValue, names[i])) break;
+
+		if (i == Count)
+			cerr << "Unknown DATA_PLACEMENT = " << policyValue << ", using " << names[Local] << endl;
+		else
+			policy = i;
+	}
+
+	return (Policy)policy;
+}
+
+const char* Placement::getName(Policy policy)
+{
+	return names[policy];
+}
+
+// Parse node or CPU list in sysfs format, e.g. "0-3,8-11".
+static vector<int> parseList(const string& list)
+{
+	vector<int> result;
+	stringstream ss(list);
+	string range;
+	while (getline(ss, range, ','))
+	{
+		if (range.empty()) continue;
+		int first = atoi(range.c_str()), last = first;
+		size_t dash = range.find('-');
+		if (dash != string::npos)
+			last = atoi(range.c_str() + dash + 1);
+		for (int i = first; i <= last; i++)
+			result.push_back(i);
+	}
+	return result;
+}
+
+static string readLine(const string& filename)
+{
+	ifstream file(filename.c_str());
+	string line;
+	getline(file, line);
+	return line;
+}
+
+static vector<int> readNodes()
+{
+	vector<int> nodes = parseList(readLine("/sys/devices/system/node/has_memory"));
+	if (nodes.empty())
+		nodes.push_back(0);
+	return nodes;
+}
+
+// NUMA node of every CPU.
+static vector<int> readNodesOfCPUs()
+{
+	vector<int> nodes;
+	vector<int> online = parseList(readLine("/sys/devices/system/node/online"));
+	for (int i = 0; i < (int)online.size(); i++)
+	{
+		stringstream sfilename;
+		sfilename << "/sys/devices/system/node/node" << online[i] << "/cpulist";
+		vector<int> cpus = parseList(readLine(sfilename.str()));
+		for (int j = 0; j < (int)cpus.size(); j++)
+		{
+			if ((int)nodes.size() <= cpus[j])
+				nodes.resize(cpus[j] + 1, 0);
+			nodes[cpus[j]] = online[i];
+		}
+	}
+	return nodes;
+}
+
+const vector<int>& Placement::getNodes()
+{
+	static vector<int> nodes = readNodes();
+	return nodes;
+}
+
+int Placement::getCurrentNode()
+{
+	static vector<int> nodes = readNodesOfCPUs();
+
+	int cpu = sched_getcpu();
+	if ((cpu < 0) || (cpu >= (int)nodes.size())) return 0;
+	return nodes[cpu];
+}
+
+static bool mbind(void* ptr, size_t size, int mode, const vector<int>& nodes)
+{
+	// Only whole pages can be moved, and explicit huge pages only as a whole.
+	size_t page = Memory::getPageSize(ptr);
+	size_t begin = ((size_t)ptr + page - 1) / page * page;
+	size_t end = ((size_t)ptr + size) / page * page;
+	if (begin >= end) return true;
+
+	unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))];
+	memset(mask, 0, sizeof(mask));
+	for (int i = 0; i < (int)nodes.size(); i++)
+		if (nodes[i] < MAX_NODES)
+			mask[nodes[i] / (8 * sizeof(unsigned long))] |= 1UL << (nodes[i] % (8 * sizeof(unsigned long)));
+
+	if (syscall(SYS_mbind, begin, end - begin, mode, mask, MAX_NODES + 1, MPOL_MF_MOVE))
+	{
+		static bool warned = false;
+		if (!warned)
+		{
+			cerr << "Cannot move data pages between NUMA nodes: " << strerror(errno) << endl;
+			warned = true;
+		}
+		return false;
+	}
+
+	return true;
+}
+
+bool Placement::interleave(void* ptr, size_t size)
+{
+	return mbind(ptr, size, MPOL_INTERLEAVE, getNodes());
+}
+
+bool Placement::bind(void* ptr, size_t size, int node)
+{
+	return mbind(ptr, size, MPOL_BIND, vector<int>(1, node));
+}
+
+void Placement::query(const void* ptr, size_t size, vector<long>& bytes)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t begin = (size_t)ptr / page * page;
+	size_t end = (size_t)ptr + size;
+
+	// Node of every page, in batches.
+	const int batch = 4096;
+	vector<void*> pages(batch);
+	vector<int> status(batch);
+	for (size_t first = begin; first < end; first += batch * page)
+	{
+		int n = 0;
+		for (size_t p = first; (p < end) && (n < batch); p += page)
+			pages[n++] = (void*)p;
+
+		if (syscall(SYS_move_pages, 0, n, &pages[0], NULL, &status[0], 0))
+			return;
+
+		for (int i = 0; i < n; i++)
+		{
+			// Pages not yet touched, or not resident, report negative status.
+			int node = status[i];
+			if (node < 0) continue;
+
+			if ((int)bytes.size() <= node)
+				bytes.resize(node + 1, 0);
+			bytes[node] += page;
+		}
+	}
+}
+
+Placement::Policy Placement::getPolicy(const Data* data)
+{
+	return data->placement;
+}
+
+Placement::Policy Placement::getPlacement(const Data* data, vector<long>& bytes)
+{
+	bytes.clear();
+	for (int istate = 0; istate < data->nstates; istate++)
+	{
+		if (!data->loadedStates[istate]) continue;
+
+		query(data->index[istate].getData(), data->index[istate].getSize(), bytes);
+		query(data->surplus[istate].getData(), data->surplus[istate].getSize(), bytes);
+
+		for (int node = 0; node < (int)data->indexReplicas.size(); node++)
+		{
+			if (data->indexReplicas[node].empty()) continue;
+
+			query(data->indexReplicas[node][istate].getData(), data->indexReplicas[node][istate].getSize(), bytes);
+			query(data->surplusReplicas[node][istate].getData(), data->surplusReplicas[node][istate].getSize(), bytes);
+		}
+	}
+
+	return data->placement;
+}
+
+// Get bytes of index and surplus of data (replicas included) resident
+// on each NUMA node into bytes, indexed by node, for nodes below maxNodes.
+// Returns the number of nodes, which may exceed maxNodes, for the caller
+// to retry with a larger buffer.
+extern "C" int getPlacement(const Data* data, long* bytes, int maxNodes)
+{
+	vector<long> resident;
+	Placement::getPlacement(data, resident);
+
+	for (int node = 0; node < maxNodes; node++)
+		bytes[node] = (node < (int)resident.size()) ? resident[node] : 0;
+
+	return resident.size();
+}
+
+// Get placement policy of data, as Placement::Policy.
+extern "C" int getPlacementPolicy(const Data* data)
+{
+	return Placement::getPolicy(data);
+}
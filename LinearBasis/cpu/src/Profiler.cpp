@@ -0,0 +1,309 @@
+#include "check.h"
+#include "Profiler.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <iomanip>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <mpi.h>
+#include <sstream>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace cpu;
+using namespace std;
+
+static const char* names[] =
+{
+	"DataLoad",
+	"JITCompile",
+	"InterpolateValue",
+	"InterpolateArray",
+	"InterpolateArrayManyStateless",
+	"InterpolateArrayManyMultistate"
+};
+
+// Cache line size, to estimate DRAM traffic from LLC misses.
+static const int cacheLineSize = 64;
+
+// Counters of all threads ever used, never freed: a thread could exit
+// before finalize, but its counters shall still be reported.
+static Profiler::Thread* threads = NULL;
+static int nthreads = 0;
+
+static __thread Profiler::Thread* thread = NULL;
+
+// Calls of this thread are not profiled, while non-zero.
+static __thread int suspended = 0;
+
+bool Profiler::isEnabled()
+{
+	static int enabled = -1;
+	if (enabled == -1)
+		enabled = (getenv("PROFILE") != NULL);
+
+	return enabled && !suspended;
+}
+
+void Profiler::suspend(bool suspend)
+{
+	suspended += suspend ? 1 : -1;
+}
+
+static int openEvent(unsigned long long config, int group)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP;
+
+	// User space only, which is allowed with perf_event_paranoid up to 2.
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	// Calling thread, on any CPU.
+	return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+Profiler::Thread& Profiler::getThread()
+{
+	if (thread) return *thread;
+
+	Thread* t = new Thread();
+	memset(t, 0, sizeof(Thread));
+	t->id = __sync_fetch_and_add(&nthreads, 1);
+
+	const unsigned long long configs[] =
+	{
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES
+	};
+
+	// Cycles lead the group, so that all events are read at once.
+	t->fd = openEvent(configs[0], -1);
+	for (int e = 0; e < EventCount; e++)
+		t->slots[e] = -1;
+	if (t->fd != -1)
+	{
+		t->slots[EventCycles] = 0;
+		for (int e = 1, slot = 1; e < EventCount; e++)
+			if (openEvent(configs[e], t->fd) != -1)
+				t->slots[e] = slot++;
+	}
+	else if (!t->id)
+		cerr << "Hardware counters are not available (" << strerror(errno) <<
+			"), profiling time only" << endl;
+
+	// Lock-free push into the list of all threads.
+	do t->next = threads;
+	while (!__sync_bool_compare_and_swap(&threads, t->next, t));
+
+	thread = t;
+	return *thread;
+}
+
+void Profiler::readEvents(Thread& thread, unsigned long long* values)
+{
+	memset(values, 0, sizeof(unsigned long long) * EventCount);
+	if (thread.fd == -1) return;
+
+	// Group read format: number of events, then values in order of opening.
+	unsigned long long buffer[1 + EventCount];
+	if (::read(thread.fd, buffer, sizeof(buffer)) <= 0) return;
+
+	for (int e = 0; e < EventCount; e++)
+		if ((thread.slots[e] != -1) && ((unsigned long long)thread.slots[e] < buffer[0]))
+			values[e] = buffer[1 + thread.slots[e]];
+}
+
+void Profiler::Scope::start()
+{
+	thread = &getThread();
+	readEvents(*thread, values);
+	begin = Tracer::now();
+}
+
+void Profiler::Scope::stop()
+{
+	long long end = Tracer::now();
+	unsigned long long finals[EventCount];
+	readEvents(*thread, finals);
+
+	thread->calls[kind]++;
+	thread->nanoseconds[kind] += end - begin;
+	thread->flops[kind] += getFlops(dim, nno, ndofs, count);
+	thread->bytes[kind] += getBytes(dim, nno, ndofs, count);
+	for (int e = 0; e < EventCount; e++)
+	{
+		if (thread->slots[e] == -1) continue;
+
+		thread->events[kind][e] += finals[e] - values[e];
+		thread->eventCalls[kind][e]++;
+	}
+}
+
+// Results of calibration loops are stored here, for the compiler
+// not to drop the loops as dead code.
+static volatile double sink;
+
+// Single-threaded peak of the kind of arithmetic kernels do, in GFLOP/s:
+// independent multiply-add chains, left for the compiler to vectorize.
+static double calibrateFlops()
+{
+	const int width = 32;
+	double a[width];
+	for (int i = 0; i < width; i++)
+		a[i] = 1.0 + i * 1e-9;
+	const double m = 0.999999999, c = 1e-9;
+
+	const int iterations = 1000000;
+	long long begin = Tracer::now();
+	for (int k = 0; k < iterations; k++)
+		for (int i = 0; i < width; i++)
+			a[i] = a[i] * m + c;
+	long long end = Tracer::now();
+
+	double sum = 0;
+	for (int i = 0; i < width; i++)
+		sum += a[i];
+	sink = sum;
+
+	return 2.0 * width * iterations / (end - begin);
+}
+
+// Single-threaded streaming read bandwidth from memory, in GB/s.
+static double calibrateBandwidth()
+{
+	const size_t length = 64 * 1024 * 1024 / sizeof(double);
+	vector<double> data(length, 1.0);
+
+	double best = 0;
+	for (int pass = 0; pass < 3; pass++)
+	{
+		double sum[4] = { 0, 0, 0, 0 };
+		long long begin = Tracer::now();
+		for (size_t i = 0; i < length; i += 4)
+		{
+			sum[0] += data[i];
+			sum[1] += data[i + 1];
+			sum[2] += data[i + 2];
+			sum[3] += data[i + 3];
+		}
+		long long end = Tracer::now();
+
+		sink = sum[0] + sum[1] + sum[2] + sum[3];
+		best = max(best, (double)length * sizeof(double) / (end - begin));
+	}
+
+	return best;
+}
+
+// Called at MPI_Finalize, while MPI is still usable, as attributes
+// of MPI_COMM_SELF are deleted first.
+static int finalize(MPI_Comm comm, int keyval, void* value, void* extra)
+{
+	int rank;
+	MPI_ERR_CHECK(MPI_Comm_rank(MPI_COMM_WORLD, &rank));
+
+	// Per-rank totals over all threads: calls, nanoseconds, flops, bytes,
+	// then events and number of calls they were measured for.
+	const int nfields = 4 + 2 * Profiler::EventCount;
+	const int nvalues = nfields * CounterKindCount;
+	vector<double> totals(nvalues), sums(nvalues);
+	for (Profiler::Thread* t = threads; t; t = t->next)
+		for (int kind = 0; kind < CounterKindCount; kind++)
+		{
+			double* total = &totals[kind * nfields];
+			total[0] += t->calls[kind];
+			total[1] += t->nanoseconds[kind];
+			total[2] += t->flops[kind];
+			total[3] += t->bytes[kind];
+			for (int e = 0; e < Profiler::EventCount; e++)
+			{
+				total[4 + e] += t->events[kind][e];
+				total[4 + Profiler::EventCount + e] += t->eventCalls[kind][e];
+			}
+		}
+
+	MPI_ERR_CHECK(MPI_Reduce(&totals[0], &sums[0], nvalues, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD));
+
+	if (rank) return MPI_SUCCESS;
+
+	const char* peakFlopsValue = getenv("PROFILE_PEAK_GFLOPS");
+	const char* peakBandwidthValue = getenv("PROFILE_PEAK_GBS");
+	const double peakFlops = peakFlopsValue ? atof(peakFlopsValue) : calibrateFlops();
+	const double peakBandwidth = peakBandwidthValue ? atof(peakBandwidthValue) : calibrateBandwidth();
+	const double balance = peakFlops / peakBandwidth;
+
+	cout << "Roofline summary, over all ranks, per thread: peak " << fixed << setprecision(2) <<
+		peakFlops << " GFLOP/s, " << peakBandwidth << " GB/s, balance " << balance << " FLOP/byte" << endl;
+	cout << "FLOP and byte counts are analytic upper bounds, DRAM traffic is LLC misses x " <<
+		cacheLineSize << " bytes" << endl;
+	cout << setw(32) << left << "kind" << right <<
+		setw(10) << "calls" << setw(10) << "us/call" << setw(10) << "GFLOP/s" << setw(10) << "GB/s" <<
+		setw(10) << "FLOP/B" << setw(10) << "% roof" << setw(10) << "bound" <<
+		setw(8) << "IPC" << setw(14) << "LLC miss/call" << setw(12) << "DRAM GB/s" << endl;
+	for (int kind = 0; kind < CounterKindCount; kind++)
+	{
+		const double* sum = &sums[kind * nfields];
+		const double calls = sum[0], seconds = sum[1] * 1e-9, flops = sum[2], bytes = sum[3];
+		if (!calls || !seconds) continue;
+
+		const double* events = sum + 4;
+		const double* eventCalls = sum + 4 + Profiler::EventCount;
+
+		const double intensity = flops / bytes;
+		const double achieved = flops / seconds * 1e-9;
+		const double roof = min(peakFlops, intensity * peakBandwidth);
+
+		cout << setw(32) << left << names[kind] << right << setprecision(2) <<
+			setw(10) << (unsigned long long)calls <<
+			setw(10) << seconds * 1e6 / calls <<
+			setw(10) << achieved <<
+			setw(10) << bytes / seconds * 1e-9 <<
+			setw(10) << intensity <<
+			setw(10) << 100.0 * achieved / roof <<
+			setw(10) << ((intensity < balance) ? "memory" : "compute");
+
+		if (eventCalls[Profiler::EventInstructions] && events[Profiler::EventCycles])
+			cout << setw(8) << events[Profiler::EventInstructions] / events[Profiler::EventCycles];
+		else
+			cout << setw(8) << "n/a";
+
+		// Time of calls with measured misses is not known separately,
+		// thus DRAM bandwidth is scaled by the share of such calls.
+		if (eventCalls[Profiler::EventCacheMisses])
+		{
+			const double misses = events[Profiler::EventCacheMisses];
+			const double share = eventCalls[Profiler::EventCacheMisses] / calls;
+			cout << setw(14) << misses / eventCalls[Profiler::EventCacheMisses] <<
+				setw(12) << misses * cacheLineSize / (seconds * share) * 1e-9;
+		}
+		else
+			cout << setw(14) << "n/a" << setw(12) << "n/a";
+
+		cout << endl;
+	}
+
+	return MPI_SUCCESS;
+}
+
+void Profiler::initialize()
+{
+	static bool initialized = false;
+	if (initialized || !isEnabled()) return;
+	initialized = true;
+
+	int keyval;
+	MPI_ERR_CHECK(MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, finalize, &keyval, NULL));
+	MPI_ERR_CHECK(MPI_Comm_set_attr(MPI_COMM_SELF, keyval, NULL));
+}
+
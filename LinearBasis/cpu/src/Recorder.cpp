@@ -0,0 +1,191 @@
+#include "check.h"
+#include "process.h"
+#include "Recorder.h"
+#include "Tracer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mpi.h>
+#include <pthread.h>
+#include <sstream>
+#include <vector>
+
+using namespace cpu;
+using namespace std;
+
+namespace {
+
+struct Thread
+{
+	vector<char> buffer;
+	size_t capacity;
+
+	int id;
+	Thread* next;
+};
+
+} // namespace
+
+static FILE* file = NULL;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Buffers of all threads ever used, never freed: a thread could exit
+// before finalize, but its calls shall still be written.
+static Thread* threads = NULL;
+static int nthreads = 0;
+
+static __thread Thread* thread = NULL;
+
+// Calls of this thread are not recorded, while non-zero.
+static __thread int suspended = 0;
+
+bool Recorder::isEnabled()
+{
+	static int enabled = -1;
+	if (enabled == -1)
+		enabled = (getenv("RECORD") != NULL);
+
+	return enabled && !suspended;
+}
+
+void Recorder::suspend(bool suspend)
+{
+	suspended += suspend ? 1 : -1;
+}
+
+static Thread& getThread()
+{
+	if (thread) return *thread;
+
+	size_t capacity = 1024 * 1024;
+	const char* capacityValue = getenv("RECORD_BUFFER");
+	if (capacityValue)
+		capacity = atoll(capacityValue);
+
+	Thread* t = new Thread();
+	t->buffer.reserve(capacity);
+	t->capacity = capacity;
+	t->id = __sync_fetch_and_add(&nthreads, 1);
+
+	// Lock-free push into the list of all threads.
+	do t->next = threads;
+	while (!__sync_bool_compare_and_swap(&threads, t->next, t));
+
+	thread = t;
+	return *thread;
+}
+
+static void flush(Thread& t)
+{
+	if (t.buffer.empty()) return;
+
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+	if (fwrite(&t.buffer[0], 1, t.buffer.size(), file) != t.buffer.size())
+		cerr << "Error writing record of interpolation calls" << endl;
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+
+	t.buffer.clear();
+}
+
+static inline void append(Thread& t, const void* data, size_t size)
+{
+	const char* bytes = reinterpret_cast<const char*>(data);
+	t.buffer.insert(t.buffer.end(), bytes, bytes + size);
+}
+
+static inline Thread& begin(const Recorder::Call& call, size_t size)
+{
+	Thread& t = getThread();
+	if (t.buffer.size() + sizeof(call) + size > t.capacity)
+		flush(t);
+
+	append(t, &call, sizeof(call));
+	return t;
+}
+
+static inline Recorder::Call getCall(int kind, int dim, int istate,
+	int Dof_choice_start, int Dof_choice_end, int count)
+{
+	Recorder::Call call;
+	memset(&call, 0, sizeof(call));
+	call.kind = kind;
+	call.thread = getThread().id;
+	call.dim = dim;
+	call.istate = istate;
+	call.Dof_choice_start = Dof_choice_start;
+	call.Dof_choice_end = Dof_choice_end;
+	call.count = count;
+	call.time = Tracer::now();
+	return call;
+}
+
+void Recorder::record(int kind, int dim, int istate,
+	int Dof_choice_start, int Dof_choice_end, int count, const real* x, int ldx)
+{
+	Call call = getCall(kind, dim, istate, Dof_choice_start, Dof_choice_end, count);
+	size_t size = sizeof(real) * count * dim;
+	Thread& t = begin(call, size);
+	if (!ldx || (ldx == dim))
+		append(t, x, size);
+	else
+		for (int i = 0; i < count; i++)
+			append(t, x + (size_t)i * ldx, sizeof(real) * dim);
+}
+
+void Recorder::record(int kind, int dim,
+	int Dof_choice_start, int Dof_choice_end, int nstates, const real* const* x)
+{
+	Call call = getCall(kind, dim, -1, Dof_choice_start, Dof_choice_end, nstates);
+	size_t size = sizeof(real) * nstates * dim;
+	Thread& t = begin(call, size);
+	for (int i = 0; i < nstates; i++)
+		append(t, x[i], sizeof(real) * dim);
+}
+
+// Called at MPI_Finalize, as attributes of MPI_COMM_SELF are deleted first.
+static int finalize(MPI_Comm comm, int keyval, void* value, void* extra)
+{
+	for (Thread* t = threads; t; t = t->next)
+		flush(*t);
+
+	fclose(file);
+	file = NULL;
+
+	return MPI_SUCCESS;
+}
+
+void Recorder::initialize()
+{
+	static bool initialized = false;
+	if (initialized || !isEnabled()) return;
+	initialized = true;
+
+	MPI_Process* process;
+	MPI_ERR_CHECK(MPI_Process_get(&process));
+
+	int rank;
+	MPI_ERR_CHECK(MPI_Comm_rank(MPI_COMM_WORLD, &rank));
+
+	stringstream filename;
+	filename << getenv("RECORD") << "." << rank << ".bin";
+	file = fopen(filename.str().c_str(), "wb");
+	if (!file)
+	{
+		cerr << "Cannot open record file " << filename.str() << endl;
+		process->abort();
+	}
+
+	Header header;
+	memset(&header, 0, sizeof(header));
+	strcpy(header.magic, "hddmrec");
+	header.version = 1;
+	header.realSize = sizeof(real);
+	fwrite(&header, sizeof(header), 1, file);
+
+	int keyval;
+	MPI_ERR_CHECK(MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, finalize, &keyval, NULL));
+	MPI_ERR_CHECK(MPI_Comm_set_attr(MPI_COMM_SELF, keyval, NULL));
+}
+
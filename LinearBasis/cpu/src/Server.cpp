@@ -0,0 +1,616 @@
+#include "check.h"
+#include "Data.h"
+#include "Server.h"
+#include "Strided.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/futex.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace cpu;
+using namespace std;
+
+enum SlotState { SlotFree = 0, SlotClaimed, SlotSubmitted, SlotRunning, SlotDone };
+
+// Slot is held by the client process in owner from claim until the client
+// frees it, owner is 0 for a free slot.
+struct Slot
+{
+	int state, owner;
+	int istate, Dof_choice_start, Dof_choice_end, count;
+	int error;
+};
+
+// Ring header, followed by slots, each followed by its points (with rows
+// padded to vector size) and values, all aligned by cache line.
+struct Server::Ring
+{
+	int dim, vdim, nno, TotalDof, nstates;
+	int nslots, npoints;
+	size_t slotSize, valueOffset;
+
+	// Incremented by clients on submission, futex the server sleeps on.
+	int doorbell;
+	int sleeping;
+};
+
+static const size_t lineSize = 64;
+
+static size_t align(size_t size)
+{
+	return (size + lineSize - 1) / lineSize * lineSize;
+}
+
+static Slot* getSlot(Server::Ring* ring, int i)
+{
+	return (Slot*)((char*)ring + align(sizeof(Server::Ring)) + i * ring->slotSize);
+}
+
+static real* getX(Slot* slot)
+{
+	return (real*)((char*)slot + align(sizeof(Slot)));
+}
+
+static real* getValue(Server::Ring* ring, Slot* slot)
+{
+	return (real*)((char*)slot + ring->valueOffset);
+}
+
+static void futexWait(int* addr, int value, long nanoseconds)
+{
+	struct timespec timeout;
+	timeout.tv_sec = nanoseconds / 1000000000;
+	timeout.tv_nsec = nanoseconds % 1000000000;
+	syscall(SYS_futex, addr, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+static void futexWake(int* addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// Free slots held by the given client process, which has closed all its
+// connections, thus it either has exited, or crashed in the middle of
+// a request. Returns false, if some of its slots are still in the hands
+// of server, and shall be freed later.
+static bool reclaim(Server::Ring* ring, pid_t owner)
+{
+	bool reclaimed = true;
+	for (int i = 0; i < ring->nslots; i++)
+	{
+		Slot* slot = getSlot(ring, i);
+		if (__atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE) != owner) continue;
+
+		int state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+		if ((state == SlotSubmitted) || (state == SlotRunning))
+		{
+			reclaimed = false;
+			continue;
+		}
+
+		__atomic_store_n(&slot->state, SlotFree, __ATOMIC_RELAXED);
+		__atomic_store_n(&slot->owner, 0, __ATOMIC_RELEASE);
+	}
+
+	return reclaimed;
+}
+
+Server::Server(const Data* data_, const char* path_) : data(data_), path(path_), ring(NULL), stopped(0)
+{
+	MPI_Process* process;
+	MPI_ERR_CHECK(MPI_Process_get(&process));
+
+	int nslots = 256;
+	const char* nslotsValue = getenv("SERVER_SLOTS");
+	if (nslotsValue)
+		nslots = max(1, atoi(nslotsValue));
+
+	int npoints = 16;
+	const char* npointsValue = getenv("SERVER_POINTS");
+	if (npointsValue)
+		npoints = max(1, atoi(npointsValue));
+
+	const int vdim = data->vdim * AVX_VECTOR_SIZE;
+	size_t valueOffset = align(sizeof(Slot)) + align(sizeof(real) * npoints * vdim);
+	size_t slotSize = valueOffset + align(sizeof(real) * npoints * data->TotalDof);
+	size = align(sizeof(Ring)) + nslots * slotSize;
+
+	// Ring is passed to clients by descriptor, thus it needs no name.
+	stringstream sname;
+	sname << "/LinearBasis_CPU_Server_" << getpid();
+	string name = sname.str();
+	fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+	if (fd == -1)
+	{
+		cerr << "Cannot create shared memory for server: " << strerror(errno) << endl;
+		process->abort();
+	}
+	shm_unlink(name.c_str());
+	if (ftruncate(fd, size))
+	{
+		cerr << "Cannot allocate " << size << " bytes of shared memory for server: " << strerror(errno) << endl;
+		process->abort();
+	}
+	ring = (Ring*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED)
+	{
+		cerr << "Cannot map shared memory for server: " << strerror(errno) << endl;
+		process->abort();
+	}
+
+	ring->dim = data->dim;
+	ring->vdim = vdim;
+	ring->nno = data->nno;
+	ring->TotalDof = data->TotalDof;
+	ring->nstates = data->nstates;
+	ring->nslots = nslots;
+	ring->npoints = npoints;
+	ring->slotSize = slotSize;
+	ring->valueOffset = valueOffset;
+	ring->doorbell = 0;
+	ring->sleeping = 0;
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+	{
+		cerr << "Server socket path is too long: " << path << endl;
+		process->abort();
+	}
+	strcpy(addr.sun_path, path.c_str());
+	unlink(path.c_str());
+
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((listener == -1) || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) || listen(listener, 16))
+	{
+		cerr << "Cannot listen on server socket " << path << ": " << strerror(errno) << endl;
+		process->abort();
+	}
+}
+
+Server::~Server()
+{
+	close(listener);
+	unlink(path.c_str());
+	munmap(ring, size);
+	close(fd);
+}
+
+// Hand out the ring to connecting clients, and take commands.
+void* Server::control(void* server_)
+{
+	Server* server = (Server*)server_;
+
+	vector<struct pollfd> fds(1);
+	fds[0].fd = server->listener;
+	fds[0].events = POLLIN;
+
+	// Client process of every connection, and processes with no connections
+	// left, whose slots are to be freed.
+	vector<pid_t> pids(1);
+	vector<pid_t> gone;
+
+	while (!__atomic_load_n(&server->stopped, __ATOMIC_ACQUIRE))
+	{
+		// Process, which has connected again, is not gone.
+		for (int i = gone.size() - 1; i >= 0; i--)
+			if ((find(pids.begin(), pids.end(), gone[i]) != pids.end()) || reclaim(server->ring, gone[i]))
+				gone.erase(gone.begin() + i);
+
+		if (poll(&fds[0], fds.size(), 100) <= 0) continue;
+
+		for (int i = fds.size() - 1; i >= 1; i--)
+		{
+			if (!fds[i].revents) continue;
+
+			char command[16] = "";
+			ssize_t length = read(fds[i].fd, command, sizeof(command) - 1);
+			if ((length > 0) && !strncmp(command, "stop", 4))
+			{
+				__atomic_store_n(&server->stopped, 1, __ATOMIC_RELEASE);
+				__atomic_fetch_add(&server->ring->doorbell, 1, __ATOMIC_SEQ_CST);
+				futexWake(&server->ring->doorbell);
+			}
+			if (length <= 0)
+			{
+				close(fds[i].fd);
+				fds.erase(fds.begin() + i);
+				pid_t pid = pids[i];
+				pids.erase(pids.begin() + i);
+				if (find(pids.begin(), pids.end(), pid) == pids.end())
+					gone.push_back(pid);
+			}
+		}
+
+		if (!fds[0].revents) continue;
+
+		int client = accept(server->listener, NULL, NULL);
+		if (client == -1) continue;
+
+		struct ucred credentials;
+		socklen_t length = sizeof(credentials);
+		if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &credentials, &length))
+		{
+			close(client);
+			continue;
+		}
+
+		char byte = 0;
+		struct iovec iov;
+		iov.iov_base = &byte;
+		iov.iov_len = 1;
+		char control[CMSG_SPACE(sizeof(int))];
+		memset(control, 0, sizeof(control));
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &server->fd, sizeof(int));
+		if (sendmsg(client, &msg, 0) != 1)
+		{
+			close(client);
+			continue;
+		}
+
+		struct pollfd pfd;
+		pfd.fd = client;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		fds.push_back(pfd);
+		pids.push_back(credentials.pid);
+	}
+
+	for (int i = 1; i < (int)fds.size(); i++)
+		close(fds[i].fd);
+
+	return NULL;
+}
+
+static void complete(Slot* slot, int error)
+{
+	slot->error = error;
+	__atomic_store_n(&slot->state, SlotDone, __ATOMIC_RELEASE);
+	futexWake(&slot->state);
+}
+
+bool Server::serve(Vector<real>& x, Vector<real>& value)
+{
+	vector<Slot*> slots;
+	for (int i = 0; i < ring->nslots; i++)
+	{
+		Slot* slot = getSlot(ring, i);
+		int state = SlotSubmitted;
+		if (__atomic_compare_exchange_n(&slot->state, &state, SlotRunning,
+			false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			slots.push_back(slot);
+	}
+	if (slots.empty()) return false;
+
+	TRACE_SCOPE("Server::serve");
+
+	// Reject malformed requests.
+	for (int i = slots.size() - 1; i >= 0; i--)
+	{
+		Slot* slot = slots[i];
+		if ((slot->istate < 0) || (slot->istate >= data->nstates) || !data->loadedStates[slot->istate] ||
+			(slot->Dof_choice_start < 0) || (slot->Dof_choice_start > slot->Dof_choice_end) ||
+			(slot->Dof_choice_end >= data->TotalDof) || (slot->count < 1) || (slot->count > ring->npoints))
+		{
+			complete(slot, 1);
+			slots.erase(slots.begin() + i);
+		}
+	}
+
+	// Merge slots for the same state and Dof range from all clients.
+	while (!slots.empty())
+	{
+		const Slot first = *slots[0];
+		const int TotalDof = first.Dof_choice_end - first.Dof_choice_start + 1;
+
+		vector<Slot*> batch;
+		int count = 0;
+		for (int i = slots.size() - 1; i >= 0; i--)
+		{
+			Slot* slot = slots[i];
+			if ((slot->istate != first.istate) || (slot->Dof_choice_start != first.Dof_choice_start) ||
+				(slot->Dof_choice_end != first.Dof_choice_end)) continue;
+
+			batch.push_back(slot);
+			count += slot->count;
+			slots.erase(slots.begin() + i);
+		}
+
+		// Points are kept with stride of padded dim, as in slots.
+		const int ldx = ring->vdim;
+		if (x.length() < count * ldx)
+			x.resize(count * ldx);
+		if (value.length() < count * TotalDof)
+			value.resize(count * TotalDof);
+
+		for (int i = 0, offset = 0; i < (int)batch.size(); offset += batch[i]->count, i++)
+			memcpy(x.getData() + offset * ldx, getX(batch[i]), sizeof(real) * batch[i]->count * ldx);
+
+		Strided::interpolate(NULL, data, first.istate, x.getData(), ldx,
+			first.Dof_choice_start, first.Dof_choice_end, count, value.getData(), TotalDof);
+
+		for (int i = 0, offset = 0; i < (int)batch.size(); offset += batch[i]->count, i++)
+			memcpy(getValue(ring, batch[i]), value.getData() + offset * TotalDof, sizeof(real) * batch[i]->count * TotalDof);
+
+		for (int i = 0; i < (int)batch.size(); i++)
+			complete(batch[i], 0);
+	}
+
+	return true;
+}
+
+void Server::run()
+{
+	cout << "Serving CPU interpolation for dim = " << data->dim << " on " << path << endl;
+
+	pthread_t thread;
+	PTHREAD_ERR_CHECK(pthread_create(&thread, NULL, &Server::control, this));
+
+	Vector<real> x, value;
+	while (!__atomic_load_n(&stopped, __ATOMIC_ACQUIRE))
+	{
+		int doorbell = __atomic_load_n(&ring->doorbell, __ATOMIC_SEQ_CST);
+		if (serve(x, value)) continue;
+
+		// Clients wake the server, if it is sleeping: either the client
+		// sees the flag, or the server sees the new doorbell.
+		__atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&ring->doorbell, __ATOMIC_SEQ_CST) == doorbell)
+			futexWait(&ring->doorbell, doorbell, 100000000);
+		__atomic_store_n(&ring->sleeping, 0, __ATOMIC_SEQ_CST);
+	}
+
+	PTHREAD_ERR_CHECK(pthread_join(thread, NULL));
+}
+
+Client::Client(int socket_, Server::Ring* ring_, size_t size_) : socket(socket_), ring(ring_), size(size_) { }
+
+Client* Client::connect(const char* path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) return NULL;
+	strcpy(addr.sun_path, path);
+
+	int sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == -1) return NULL;
+	if (::connect(sock, (struct sockaddr*)&addr, sizeof(addr)))
+	{
+		close(sock);
+		return NULL;
+	}
+
+	char byte;
+	struct iovec iov;
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	struct cmsghdr* cmsg;
+	int fd = -1;
+	if ((recvmsg(sock, &msg, 0) == 1) && (cmsg = CMSG_FIRSTHDR(&msg)) &&
+		(cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	if (fd == -1)
+	{
+		close(sock);
+		return NULL;
+	}
+
+	struct stat st;
+	void* ring = MAP_FAILED;
+	if (!fstat(fd, &st))
+		ring = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED)
+	{
+		close(sock);
+		return NULL;
+	}
+
+	return new Client(sock, (Server::Ring*)ring, st.st_size);
+}
+
+Client::~Client()
+{
+	munmap(ring, size);
+	close(socket);
+}
+
+int Client::getDim() const { return ring->dim; }
+
+int Client::getTotalDof() const { return ring->TotalDof; }
+
+// Claim a free slot for the calling process, looking through the ring once,
+// starting from the hint, or return NULL, if all slots are taken.
+static Slot* claim(Server::Ring* ring, pid_t pid, unsigned int& hint)
+{
+	for (int i = 0; i < ring->nslots; i++)
+	{
+		Slot* slot = getSlot(ring, (hint + i) % ring->nslots);
+		int owner = 0;
+		if (__atomic_compare_exchange_n(&slot->owner, &owner, pid,
+			false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		{
+			__atomic_store_n(&slot->state, SlotClaimed, __ATOMIC_RELAXED);
+			hint += i + 1;
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+static void ringDoorbell(Server::Ring* ring)
+{
+	__atomic_fetch_add(&ring->doorbell, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->sleeping, __ATOMIC_SEQ_CST))
+		futexWake(&ring->doorbell);
+}
+
+// Copy values of the finished slot out, and free it,
+// returns false, if the part was rejected.
+static bool collect(Server::Ring* ring, Slot* slot, real* value, int TotalDof)
+{
+	bool success = !slot->error;
+	if (success)
+		memcpy(value, getValue(ring, slot), sizeof(real) * slot->count * TotalDof);
+
+	__atomic_store_n(&slot->state, SlotFree, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->owner, 0, __ATOMIC_RELEASE);
+	return success;
+}
+
+// Wait for the submitted slot to be finished.
+static void waitDone(Slot* slot)
+{
+	for (int spin = 0; ; spin++)
+	{
+		int state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+		if (state == SlotDone) break;
+		if (spin >= 1000)
+			futexWait(&slot->state, state, 100000000);
+	}
+}
+
+bool Client::interpolate(const int istate, const real* x,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, real* value)
+{
+	const int TotalDof = Dof_choice_end - Dof_choice_start + 1;
+
+	const pid_t pid = getpid();
+	static __thread unsigned int hint = 0;
+
+	// Submit parts of request, each into its own slot. Once the ring is full,
+	// finished parts of this request are collected to free their slots, so that
+	// requests larger than the ring, or concurrent requests filling it, proceed.
+	vector<Slot*> slots;
+	vector<int> firsts;
+	bool success = true;
+	for (int first = 0; first < count; first += ring->npoints)
+	{
+		Slot* slot;
+		while (!(slot = claim(ring, pid, hint)))
+		{
+			ringDoorbell(ring);
+
+			bool collected = false;
+			for (int i = slots.size() - 1; i >= 0; i--)
+			{
+				if (__atomic_load_n(&slots[i]->state, __ATOMIC_ACQUIRE) != SlotDone) continue;
+
+				success &= collect(ring, slots[i], value + firsts[i] * TotalDof, TotalDof);
+				slots.erase(slots.begin() + i);
+				firsts.erase(firsts.begin() + i);
+				collected = true;
+			}
+			if (collected) continue;
+
+			// Wait for the oldest part of this request, if any, otherwise
+			// for other clients to free their slots.
+			if (slots.empty())
+				sched_yield();
+			else
+			{
+				waitDone(slots[0]);
+				success &= collect(ring, slots[0], value + firsts[0] * TotalDof, TotalDof);
+				slots.erase(slots.begin());
+				firsts.erase(firsts.begin());
+			}
+		}
+
+		slot->istate = istate;
+		slot->Dof_choice_start = Dof_choice_start;
+		slot->Dof_choice_end = Dof_choice_end;
+		slot->count = min(ring->npoints, count - first);
+		for (int p = 0; p < slot->count; p++)
+			memcpy(getX(slot) + p * ring->vdim, x + (first + p) * ring->dim, sizeof(real) * ring->dim);
+		__atomic_store_n(&slot->state, SlotSubmitted, __ATOMIC_RELEASE);
+
+		slots.push_back(slot);
+		firsts.push_back(first);
+	}
+
+	ringDoorbell(ring);
+
+	for (int i = 0; i < (int)slots.size(); i++)
+	{
+		waitDone(slots[i]);
+		success &= collect(ring, slots[i], value + firsts[i] * TotalDof, TotalDof);
+	}
+
+	return success;
+}
+
+void Client::stop()
+{
+	if (write(socket, "stop", 4) != 4)
+		cerr << "Cannot send stop to server: " << strerror(errno) << endl;
+}
+
+// Serve interpolation of the given data on the given Unix socket path,
+// until a client asks to stop.
+extern "C" void runServer(const Data* data, const char* path)
+{
+	Server server(data, path);
+	server.run();
+}
+
+// Connect to the server on the given Unix socket path, return NULL,
+// if there is no server.
+extern "C" Client* connectServer(const char* path)
+{
+	return Client::connect(path);
+}
+
+// Interpolate count points by server, in the same layout, as for
+// stateless interpolation of many points. Returns false, if rejected.
+extern "C" bool interpolateServer(Client* client, int istate, const real* x,
+	int Dof_choice_start, int Dof_choice_end, int count, real* value)
+{
+	return client->interpolate(istate, x, Dof_choice_start, Dof_choice_end, count, value);
+}
+
+extern "C" void stopServer(Client* client)
+{
+	client->stop();
+}
+
+extern "C" void disconnectServer(Client* client)
+{
+	delete client;
+}
@@ -0,0 +1,131 @@
+#include "check.h"
+#include "Tracer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mpi.h>
+#include <sstream>
+
+using namespace cpu;
+using namespace std;
+
+// Ring buffers of all threads ever used, never freed: a thread could exit
+// before finalize, but its events shall still be written.
+static Tracer::Thread* threads = NULL;
+static int nthreads = 0;
+
+static __thread Tracer::Thread* thread = NULL;
+
+bool Tracer::isEnabled()
+{
+	static int enabled = -1;
+	if (enabled != -1) return enabled;
+
+	enabled = (getenv("TRACE") != NULL);
+	return enabled;
+}
+
+Tracer::Thread& Tracer::getThread()
+{
+	if (thread) return *thread;
+
+	// Ring capacity is rounded up to a power of two.
+	unsigned long long capacity = 65536;
+	const char* capacityValue = getenv("TRACE_EVENTS");
+	if (capacityValue)
+		capacity = atoll(capacityValue);
+	unsigned long long pow2 = 1;
+	while (pow2 < capacity) pow2 <<= 1;
+
+	Thread* t = new Thread();
+	t->events = new Event[pow2];
+	t->capacity = pow2;
+	t->count = 0;
+	t->id = __sync_fetch_and_add(&nthreads, 1);
+
+	// Lock-free push into the list of all threads.
+	do t->next = threads;
+	while (!__sync_bool_compare_and_swap(&threads, t->next, t));
+
+	thread = t;
+	return *thread;
+}
+
+// Total duration in seconds of all recorded events with the given name,
+// over all threads. For tools driving the library directly.
+extern "C" double LinearBasis_CPU_Tracer_getTotal(const char* name)
+{
+	long long total = 0;
+	for (Tracer::Thread* t = threads; t; t = t->next)
+	{
+		unsigned long long count = __atomic_load_n(&t->count, __ATOMIC_ACQUIRE);
+		unsigned long long first = (count > t->capacity) ? count - t->capacity : 0;
+		for (unsigned long long i = first; i < count; i++)
+		{
+			const Tracer::Event& event = t->events[i & (t->capacity - 1)];
+			if (!strcmp(event.name, name))
+				total += event.end - event.begin;
+		}
+	}
+
+	return total * 1e-9;
+}
+
+// Called at MPI_Finalize, while MPI is still usable, as attributes
+// of MPI_COMM_SELF are deleted first.
+static int finalize(MPI_Comm comm, int keyval, void* value, void* extra)
+{
+	int rank;
+	MPI_ERR_CHECK(MPI_Comm_rank(MPI_COMM_WORLD, &rank));
+
+	stringstream filename;
+	filename << getenv("TRACE") << "." << rank << ".json";
+	ofstream out(filename.str().c_str());
+	if (!out.is_open())
+	{
+		cerr << "Cannot open trace file " << filename.str() << endl;
+		return MPI_SUCCESS;
+	}
+
+	// Timestamps are absolute, so that traces of ranks sharing the same
+	// node could be merged into a single timeline.
+	out << fixed << setprecision(3);
+	out << "{\"traceEvents\":[" << endl;
+	out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << rank <<
+		",\"args\":{\"name\":\"rank " << rank << "\"}}";
+	for (Tracer::Thread* t = threads; t; t = t->next)
+	{
+		unsigned long long count = __atomic_load_n(&t->count, __ATOMIC_ACQUIRE);
+		unsigned long long first = (count > t->capacity) ? count - t->capacity : 0;
+		for (unsigned long long i = first; i < count; i++)
+		{
+			const Tracer::Event& event = t->events[i & (t->capacity - 1)];
+			out << "," << endl << "{\"name\":\"" << event.name << "\",\"ph\":\"X\"" <<
+				",\"pid\":" << rank << ",\"tid\":" << t->id <<
+				",\"ts\":" << event.begin / 1000.0 <<
+				",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+		}
+
+		if (first)
+			cerr << "Rank #" << rank << " thread " << t->id << " trace lost " << first <<
+				" oldest events, consider increasing TRACE_EVENTS" << endl;
+	}
+	out << endl << "]}" << endl;
+
+	return MPI_SUCCESS;
+}
+
+void Tracer::initialize()
+{
+	static bool initialized = false;
+	if (initialized || !isEnabled()) return;
+	initialized = true;
+
+	int keyval;
+	MPI_ERR_CHECK(MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, finalize, &keyval, NULL));
+	MPI_ERR_CHECK(MPI_Comm_set_attr(MPI_COMM_SELF, keyval, NULL));
+}
+
@@ -0,0 +1,116 @@
+#include "check.h"
+#include "WorkerPool.h"
+
+#include <sched.h>
+
+using namespace cpu;
+using namespace std;
+
+void* WorkerPool::worker(void* pool_)
+{
+	WorkerPool* pool = (WorkerPool*)pool_;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int i = 0; i < (int)pool->cpus.size(); i++)
+		CPU_SET(pool->cpus[i], &set);
+	PTHREAD_ERR_CHECK(pthread_setaffinity_np(pthread_self(), sizeof(set), &set));
+
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&pool->mutex));
+	unsigned int seen = pool->generation;
+	while (1)
+	{
+		while ((pool->generation == seen) && !pool->stop)
+			PTHREAD_ERR_CHECK(pthread_cond_wait(&pool->wake, &pool->mutex));
+		if (pool->stop) break;
+
+		// Job is read under lock, and the next job waits for all
+		// active workers, thus chunks never mix between jobs.
+		seen = pool->generation;
+		pool->active++;
+		void (*func)(void*, int) = pool->func;
+		void* arg = pool->arg;
+		int nchunks = pool->nchunks;
+		PTHREAD_ERR_CHECK(pthread_mutex_unlock(&pool->mutex));
+
+		for (int chunk; (chunk = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < nchunks; )
+			func(arg, chunk);
+
+		PTHREAD_ERR_CHECK(pthread_mutex_lock(&pool->mutex));
+		if (!--pool->active)
+			PTHREAD_ERR_CHECK(pthread_cond_broadcast(&pool->done));
+	}
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&pool->mutex));
+
+	return NULL;
+}
+
+WorkerPool::WorkerPool(const vector<int>& cpus_, int nworkers) :
+
+cpus(cpus_), func(NULL), arg(NULL), nchunks(0), next(0), active(0), generation(0), stop(false)
+
+{
+	PTHREAD_ERR_CHECK(pthread_mutex_init(&mutex, NULL));
+	PTHREAD_ERR_CHECK(pthread_mutex_init(&busy, NULL));
+	PTHREAD_ERR_CHECK(pthread_cond_init(&wake, NULL));
+	PTHREAD_ERR_CHECK(pthread_cond_init(&done, NULL));
+
+	threads.resize(nworkers);
+	for (int i = 0; i < nworkers; i++)
+		PTHREAD_ERR_CHECK(pthread_create(&threads[i], NULL, &WorkerPool::worker, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+	stop = true;
+	PTHREAD_ERR_CHECK(pthread_cond_broadcast(&wake));
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+
+	for (int i = 0; i < (int)threads.size(); i++)
+		PTHREAD_ERR_CHECK(pthread_join(threads[i], NULL));
+
+	PTHREAD_ERR_CHECK(pthread_cond_destroy(&done));
+	PTHREAD_ERR_CHECK(pthread_cond_destroy(&wake));
+	PTHREAD_ERR_CHECK(pthread_mutex_destroy(&busy));
+	PTHREAD_ERR_CHECK(pthread_mutex_destroy(&mutex));
+}
+
+int WorkerPool::getSize() const
+{
+	return threads.size() + 1;
+}
+
+void WorkerPool::run(int nchunks_, void (*func_)(void* arg, int chunk), void* arg_)
+{
+	if (pthread_mutex_trylock(&busy))
+	{
+		for (int chunk = 0; chunk < nchunks_; chunk++)
+			func_(arg_, chunk);
+		return;
+	}
+
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+
+	// Workers late for the previous job may still be looking at it.
+	while (active)
+		PTHREAD_ERR_CHECK(pthread_cond_wait(&done, &mutex));
+
+	func = func_;
+	arg = arg_;
+	nchunks = nchunks_;
+	next = 0;
+	generation++;
+	PTHREAD_ERR_CHECK(pthread_cond_broadcast(&wake));
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+
+	for (int chunk; (chunk = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED)) < nchunks_; )
+		func_(arg_, chunk);
+
+	PTHREAD_ERR_CHECK(pthread_mutex_lock(&mutex));
+	while (active)
+		PTHREAD_ERR_CHECK(pthread_cond_wait(&done, &mutex));
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&mutex));
+
+	PTHREAD_ERR_CHECK(pthread_mutex_unlock(&busy));
+}
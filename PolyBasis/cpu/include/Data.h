@@ -187,11 +187,11 @@ class Data
 	friend class Interpolator;
 
 public :
-	int getNno() const;
+	virtual int getNno() const;
 
-	void load(const char* filename, int istate);
+	virtual void load(const char* filename, int istate);
 	
-	void clear();
+	virtual void clear();
 
 	Data(int nstates);
 };
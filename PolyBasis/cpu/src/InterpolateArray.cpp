@@ -82,7 +82,7 @@ inline __attribute__((always_inline)) static double PolyBasis(double x, int i, i
 
 #define STR(funcname) #funcname
 
-void FUNCNAME(
+extern "C" void FUNCNAME(
 	const int dim, const int nno,
 	const int Dof_choice_start, const int Dof_choice_end, const double* x,
 	const Matrix<int>& index, const Matrix<double>& surplus, double* value)
@@ -95,6 +95,9 @@ void FUNCNAME(
 
 	const int TotalDof = Dof_choice_end - Dof_choice_start + 1;
 
+	for (int b = Dof_choice_start, Dof_choice = b, e = Dof_choice_end; Dof_choice <= e; Dof_choice++)
+		value[Dof_choice - b] = 0;
+
 	for (int i = 0; i < nno; i++)
 	{
 		double temp = 1.0;
@@ -80,7 +80,7 @@ inline __attribute__((always_inline)) static double PolyBasis(double x, int i, i
 	}
 }
 
-void FUNCNAME(
+extern "C" void FUNCNAME(
 	const int dim, const int nno,
 	const int Dof_choice_start, const int Dof_choice_end, const int count, const double* const* x_,
 	const std::vector<Matrix<int> >& index_, const std::vector<Matrix<double> >& surplus_, double** value_)
@@ -103,10 +103,10 @@ void FUNCNAME(
 		for (int b = Dof_choice_start, Dof_choice = b, e = Dof_choice_end; Dof_choice <= e; Dof_choice++)
 			value[Dof_choice - b] = 0;
 
-		for (int i = 0; i <= nno; i++)
+		for (int i = 0; i < nno; i++)
 		{
 			double temp = 1.0;
-			for (int j = 0; j <= DIM; j++)
+			for (int j = 0; j < DIM; j++)
 			{
 				temp *= PolyBasis(x[j], index(i, j), index(i, j + vdim));
 				if (temp == 0.0)
@@ -0,0 +1,130 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <time.h>
+#include <vector>
+
+// Synthetic sparse grid, in the same layout Data::load decodes into:
+// for each node, 2 * vdim index entries (scaled level "i" and precomputed
+// "j" for each dimension, both padded to vdim), and TotalDof surpluses.
+struct Grid
+{
+	int dim, vdim, nno, TotalDof;
+
+	std::vector<int> index;
+	std::vector<double> surplus;
+
+	Grid(int dim, int nno, int TotalDof, unsigned int seed = 0);
+};
+
+struct Config
+{
+	int dim, nno, TotalDof, count;
+};
+
+struct Result
+{
+	std::string backend, kernel, variant;
+	Config config;
+
+	// Per call of the kernel.
+	double seconds;
+	double rows;
+	double bytes;
+
+	// Against the reference variant of the same kernel: max absolute error,
+	// normwise relative error (max absolute error over max absolute reference
+	// value) and speedup.
+	double maxAbsError;
+	double maxRelError;
+	double speedup;
+};
+
+// Output and time of the reference variant of a kernel:
+// the first variant checked against it.
+struct Reference
+{
+	std::vector<double> value;
+	double seconds;
+
+	Reference() : seconds(0) { }
+};
+
+// Interpolation backend under test, linked into benchmark directly,
+// with no solver and no config file.
+class Backend
+{
+public :
+
+	virtual const char* getName() const = 0;
+
+	// Time all implemented kernels on the given grid, in all available
+	// variants (scalar, generic and runtime-optimized), and check their
+	// outputs against the scalar one.
+	virtual void run(const Grid& grid, const Config& config, int repeat, std::vector<Result>& results) = 0;
+
+	virtual ~Backend() { }
+};
+
+Backend* getLinearBasisBackend();
+Backend* getPolyBasisBackend();
+
+// Time the given function, returning the best time of a single call
+// in seconds, after one warmup call.
+template<typename F>
+double measure(F func, int repeat)
+{
+	func();
+
+	double best = 0;
+	for (int i = 0; i < repeat; i++)
+	{
+		struct timespec start, finish;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		func();
+		clock_gettime(CLOCK_MONOTONIC, &finish);
+
+		double seconds = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) * 1e-9;
+		if (!i || (seconds < best)) best = seconds;
+	}
+
+	return best;
+}
+
+// Run the given kernel variant once, compare its output against reference,
+// and time it. Output is collected with the given function, after kernel
+// is called; caller shall poison output buffers beforehand, so that
+// a kernel that leaves outputs unwritten does not pass.
+template<typename F, typename G>
+void check(F func, G output, int repeat, Reference& reference, Result& result)
+{
+	func();
+
+	std::vector<double> value;
+	output(value);
+
+	if (reference.value.empty())
+		reference.value = value;
+
+	// Written to propagate NaN.
+	double maxAbsError = 0, maxAbsValue = 0;
+	for (int i = 0; i < value.size(); i++)
+	{
+		double error = fabs(value[i] - reference.value[i]);
+		if (!(error <= maxAbsError)) maxAbsError = error;
+		maxAbsValue = std::max(maxAbsValue, fabs(reference.value[i]));
+	}
+	result.maxAbsError = maxAbsError;
+	result.maxRelError = maxAbsValue ? maxAbsError / maxAbsValue : maxAbsError;
+
+	result.seconds = measure(func, repeat);
+	if (!reference.seconds)
+		reference.seconds = result.seconds;
+	result.speedup = reference.seconds / result.seconds;
+}
+
+#endif // BENCHMARK_H
+
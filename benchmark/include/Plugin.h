@@ -0,0 +1,67 @@
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include <string>
+
+// Virtual interface of Data, same in all backends.
+class Data
+{
+public :
+	virtual int getNno() const = 0;
+
+	virtual void load(const char* filename, int istate) = 0;
+
+	virtual void clear() = 0;
+};
+
+class Device;
+
+// Virtual interface of LinearBasis interpolator
+// (PolyBasis interpolator has no device argument).
+class Interpolator
+{
+public :
+	virtual void interpolate(Device* device, const Data* data,
+		const int istate, const double* x, const int Dof_choice, double& value) = 0;
+
+	virtual void interpolate(Device* device, const Data* data,
+		const int istate, const double* x, const int Dof_choice_start, const int Dof_choice_end, double* value) = 0;
+
+	virtual void interpolate(Device* device, const Data* data,
+		const int istate, const double* x, const int Dof_choice_start, const int Dof_choice_end, const int count, double* value) = 0;
+
+	virtual void interpolate(Device* device, const Data* data,
+		const double** x, const int Dof_choice_start, const int Dof_choice_end, double** value) = 0;
+};
+
+// Postprocessor plugin, loaded standalone: plugin reads its config from
+// the current directory, thus the process moves into a temporary directory
+// with a minimal config for the given dim. Data file names shall be made
+// absolute beforehand.
+class Plugin
+{
+	std::string directory, config;
+	void* handle;
+
+public :
+
+	Plugin(const char* filename, int dim, bool jit = false);
+
+	~Plugin();
+
+	const std::string& getDirectory() const { return directory; }
+
+	// Get symbol exported by plugin, or NULL.
+	void* getSymbol(const char* name) const;
+
+	Data* getData(int nstates) const;
+
+	// Interpolator is created on first call, reading the config.
+	Interpolator* getInterpolator() const;
+
+	// Read dim from the header of data file, in text or compressed format.
+	static int getDim(const char* filename);
+};
+
+#endif // PLUGIN_H
+
@@ -0,0 +1,37 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+// Error checking macros of the solver, which backends include through
+// their Data.h, for the benchmark to build without the solver tree.
+
+#include <cstdio>
+#include <cstdlib>
+#include <mpi.h>
+#include <pthread.h>
+
+#define MPI_ERR_CHECK(call) \
+	do { \
+		int err = (call); \
+		if (err != MPI_SUCCESS) \
+		{ \
+			fprintf(stderr, "MPI error %d at %s:%d\n", err, __FILE__, __LINE__); \
+			abort(); \
+		} \
+	} while (0)
+
+#define PTHREAD_ERR_CHECK(call) \
+	do { \
+		int err = (call); \
+		if (err) \
+		{ \
+			fprintf(stderr, "pthread error %d at %s:%d\n", err, __FILE__, __LINE__); \
+			abort(); \
+		} \
+	} while (0)
+
+// Floating-point type of the solver, unless given with -Dreal.
+#ifndef real
+typedef double real;
+#endif
+
+#endif // CHECK_H
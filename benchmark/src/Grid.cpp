@@ -0,0 +1,43 @@
+#include "Benchmark.h"
+
+#include <cstdlib>
+
+using namespace std;
+
+Grid::Grid(int dim_, int nno_, int TotalDof_, unsigned int seed) :
+
+dim(dim_), nno(nno_), TotalDof(TotalDof_)
+
+{
+	vdim = dim / AVX_VECTOR_SIZE;
+	if (dim % AVX_VECTOR_SIZE) vdim++;
+	vdim *= AVX_VECTOR_SIZE;
+
+	index.resize(nno * 2 * vdim);
+	surplus.resize(nno * TotalDof);
+
+	// Like in real sparse grids, most nodes refine only a few dimensions,
+	// the rest stay on level 1, where basis is constant.
+	for (int i = 0; i < nno; i++)
+	{
+		int* row = &index[i * 2 * vdim];
+
+		int nrefined = rand_r(&seed) % 4;
+		for (int r = 0; r < nrefined; r++)
+		{
+			int j = rand_r(&seed) % dim;
+			int level = 2 + rand_r(&seed) % 4;
+
+			// Encoded as by Data::load: "i" = 2 << (level - 2), and "j"
+			// is the odd node position on this level, in units of 1 / "i".
+			int scale = 2 << (level - 2);
+			row[j] = scale;
+			row[j + vdim] = 2 * (rand_r(&seed) % (scale / 2)) + 1;
+		}
+
+		// Surpluses decay with refinement.
+		for (int k = 0; k < TotalDof; k++)
+			surplus[i * TotalDof + k] = (double)rand_r(&seed) / RAND_MAX / (1 + nrefined);
+	}
+}
+
@@ -0,0 +1,230 @@
+#include "Benchmark.h"
+#include "Data.h"
+#include "JIT.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+using namespace cpu;
+using namespace std;
+
+extern "C" void LinearBasis_CPU_Generic_InterpolateValue(
+	Device* device,
+	const int dim, const int nno,
+	const int Dof_choice, const double* x,
+	const Matrix<int>* index, const Matrix<double>* surplus, double* value_);
+
+extern "C" void LinearBasis_CPU_Generic_InterpolateArray(
+	Device* device, const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const double* x,
+	const Matrix<int>* index, const Matrix<double>* surplus, double* value);
+
+extern "C" void LinearBasis_CPU_Generic_InterpolateArrayManyStateless(
+	Device* device, const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const double* x_, const int ldx,
+	const Matrix<int>* index, const Matrix<double>* surplus, double* value, const int ldvalue);
+
+extern "C" void LinearBasis_CPU_Generic_InterpolateArrayManyMultistate(
+	Device* device, const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const double* const* x_,
+	const Matrix<int>* index, const Matrix<double>* surplus, double** value);
+
+// The same kernels, built without AVX: scalar reference.
+extern "C" void LinearBasis_CPU_Scalar_InterpolateValue(
+	Device* device,
+	const int dim, const int nno,
+	const int Dof_choice, const double* x,
+	const Matrix<int>* index, const Matrix<double>* surplus, double* value_);
+
+extern "C" void LinearBasis_CPU_Scalar_InterpolateArray(
+	Device* device, const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const double* x,
+	const Matrix<int>* index, const Matrix<double>* surplus, double* value);
+
+extern "C" void LinearBasis_CPU_Scalar_InterpolateArrayManyStateless(
+	Device* device, const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const double* x_, const int ldx,
+	const Matrix<int>* index, const Matrix<double>* surplus, double* value, const int ldvalue);
+
+extern "C" void LinearBasis_CPU_Scalar_InterpolateArrayManyMultistate(
+	Device* device, const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const double* const* x_,
+	const Matrix<int>* index, const Matrix<double>* surplus, double** value);
+
+// Runtime-optimized kernel falls back to generic, if compilation fails.
+static const char* getVariant(int variant, void* func, void* generic)
+{
+	if (variant == 0) return "scalar";
+	if (variant == 1) return "generic";
+	if (func == generic) return "jit-fallback";
+	return "jit";
+}
+
+class LinearBasisBackend : public Backend
+{
+public :
+
+	LinearBasisBackend()
+	{
+		JIT::initialize();
+	}
+
+	const char* getName() const { return "LinearBasis"; }
+
+	void run(const Grid& grid, const Config& config, int repeat, vector<Result>& results);
+};
+
+void LinearBasisBackend::run(const Grid& grid, const Config& config, int repeat, vector<Result>& results)
+{
+	const int dim = grid.dim, nno = grid.nno, TotalDof = grid.TotalDof, count = config.count;
+
+	// Every state of multistate kernel gets its own copy of grid.
+	vector<Matrix<int> > index(count, Matrix<int>(nno, 2 * grid.vdim));
+	vector<Matrix<double> > surplus(count, Matrix<double>(nno, TotalDof));
+	for (int s = 0; s < count; s++)
+		for (int i = 0; i < nno; i++)
+		{
+			for (int j = 0; j < 2 * grid.vdim; j++)
+				index[s](i, j) = grid.index[i * 2 * grid.vdim + j];
+			for (int j = 0; j < TotalDof; j++)
+				surplus[s](i, j) = grid.surplus[i * TotalDof + j];
+		}
+
+	// Stateless kernel expects points packed with stride dim.
+	unsigned int seed = 1;
+	Vector<double> x(count * dim + grid.vdim);
+	for (int i = 0; i < count * dim; i++)
+		x(i) = (double)rand_r(&seed) / RAND_MAX;
+	vector<Vector<double> > xs(count, Vector<double>(grid.vdim));
+	vector<const double*> pxs(count);
+	for (int s = 0; s < count; s++)
+	{
+		for (int i = 0; i < dim; i++)
+			xs[s](i) = x(s * dim + i);
+		pxs[s] = xs[s].getData();
+	}
+
+	Vector<double> value(count * TotalDof);
+	vector<Vector<double> > values(count, Vector<double>(TotalDof));
+	vector<double*> pvalues(count);
+	for (int s = 0; s < count; s++)
+		pvalues[s] = values[s].getData();
+
+	// Upper bound: every row of index and surplus is streamed once per point.
+	const double rowBytes = 2 * grid.vdim * sizeof(int) + TotalDof * sizeof(double);
+
+	// Poison outputs, so that unwritten values are caught by comparison.
+	const double nan = numeric_limits<double>::quiet_NaN();
+	auto poison = [&]()
+	{
+		std::fill(value.getData(), value.getData() + count * TotalDof, nan);
+		for (int s = 0; s < count; s++)
+			std::fill(pvalues[s], pvalues[s] + TotalDof, nan);
+	};
+
+	Result result;
+	result.backend = getName();
+	result.config = config;
+
+	Reference value1Reference, arrayReference, statelessReference, multistateReference;
+
+	// Variants: scalar (reference), generic (AVX, if enabled) and runtime-optimized.
+	for (int variant = 0; variant <= 2; variant++)
+	{
+		InterpolateValueFunc value1 = (InterpolateValueFunc)LinearBasis_CPU_Generic_InterpolateValue;
+		InterpolateArrayFunc array = (InterpolateArrayFunc)LinearBasis_CPU_Generic_InterpolateArray;
+		InterpolateArrayManyStatelessFunc stateless =
+			(InterpolateArrayManyStatelessFunc)LinearBasis_CPU_Generic_InterpolateArrayManyStateless;
+		InterpolateArrayManyMultistateFunc multistate =
+			(InterpolateArrayManyMultistateFunc)LinearBasis_CPU_Generic_InterpolateArrayManyMultistate;
+
+		if (variant == 0)
+		{
+			value1 = (InterpolateValueFunc)LinearBasis_CPU_Scalar_InterpolateValue;
+			array = (InterpolateArrayFunc)LinearBasis_CPU_Scalar_InterpolateArray;
+			stateless = (InterpolateArrayManyStatelessFunc)LinearBasis_CPU_Scalar_InterpolateArrayManyStateless;
+			multistate = (InterpolateArrayManyMultistateFunc)LinearBasis_CPU_Scalar_InterpolateArrayManyMultistate;
+		}
+		else if (variant == 2)
+		{
+			value1 = JIT::jitCompile(dim, 1, "LinearBasis_CPU_RuntimeOpt_InterpolateValue_", value1).getFunc();
+			array = JIT::jitCompile(dim, 1, "LinearBasis_CPU_RuntimeOpt_InterpolateArray_", array).getFunc();
+			stateless = JIT::jitCompile(dim, 1, "LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyStateless_", stateless).getFunc();
+			multistate = JIT::jitCompile(dim, count, "LinearBasis_CPU_RuntimeOpt_InterpolateArrayManyMultistate_", multistate).getFunc();
+		}
+
+		result.kernel = "InterpolateValue";
+		result.variant = getVariant(variant, (void*)value1, (void*)LinearBasis_CPU_Generic_InterpolateValue);
+		poison();
+		check([&]()
+		{
+			value1(NULL, dim, nno, 0, x.getData(), &index[0], &surplus[0], value.getData());
+		},
+		[&](vector<double>& output)
+		{
+			output.assign(value.getData(), value.getData() + 1);
+		},
+		repeat, value1Reference, result);
+		result.rows = nno;
+		result.bytes = nno * (2 * grid.vdim * sizeof(int) + sizeof(double));
+		results.push_back(result);
+
+		result.kernel = "InterpolateArray";
+		result.variant = getVariant(variant, (void*)array, (void*)LinearBasis_CPU_Generic_InterpolateArray);
+		poison();
+		check([&]()
+		{
+			array(NULL, dim, nno, 0, TotalDof - 1, x.getData(), &index[0], &surplus[0], value.getData());
+		},
+		[&](vector<double>& output)
+		{
+			output.assign(value.getData(), value.getData() + TotalDof);
+		},
+		repeat, arrayReference, result);
+		result.rows = nno;
+		result.bytes = nno * rowBytes;
+		results.push_back(result);
+
+		result.kernel = "InterpolateArrayManyStateless";
+		result.variant = getVariant(variant, (void*)stateless, (void*)LinearBasis_CPU_Generic_InterpolateArrayManyStateless);
+		poison();
+		check([&]()
+		{
+			stateless(NULL, dim, nno, 0, TotalDof - 1, count, x.getData(), dim, &index[0], &surplus[0], value.getData(), TotalDof);
+		},
+		[&](vector<double>& output)
+		{
+			output.assign(value.getData(), value.getData() + count * TotalDof);
+		},
+		repeat, statelessReference, result);
+		result.rows = (double)nno * count;
+		result.bytes = count * nno * rowBytes;
+		results.push_back(result);
+
+		result.kernel = "InterpolateArrayManyMultistate";
+		result.variant = getVariant(variant, (void*)multistate, (void*)LinearBasis_CPU_Generic_InterpolateArrayManyMultistate);
+		poison();
+		check([&]()
+		{
+			multistate(NULL, dim, nno, 0, TotalDof - 1, count, &pxs[0], &index[0], &surplus[0], &pvalues[0]);
+		},
+		[&](vector<double>& output)
+		{
+			output.clear();
+			for (int s = 0; s < count; s++)
+				output.insert(output.end(), pvalues[s], pvalues[s] + TotalDof);
+		},
+		repeat, multistateReference, result);
+		result.rows = (double)nno * count;
+		result.bytes = count * nno * rowBytes;
+		results.push_back(result);
+	}
+}
+
+Backend* getLinearBasisBackend()
+{
+	static LinearBasisBackend backend;
+	return &backend;
+}
+
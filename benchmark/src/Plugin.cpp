@@ -0,0 +1,113 @@
+#include "Plugin.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <fstream>
+#include <iostream>
+#include <limits.h>
+#include <mpi.h>
+#include <unistd.h>
+
+using namespace std;
+
+Plugin::Plugin(const char* filename, int dim, bool jit)
+{
+	char path[PATH_MAX];
+	if (!realpath(filename, path))
+	{
+		cerr << "Cannot find plugin: " << filename << endl;
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	char tmpdir[] = "/tmp/hddm-benchmark.XXXXXX";
+	if (!mkdtemp(tmpdir))
+	{
+		cerr << "Cannot create temporary directory" << endl;
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	directory = tmpdir;
+
+	config = directory + "/hddm-solver.cfg";
+	{
+		ofstream cfg(config.c_str());
+		cfg << "priorityCPU 0" << endl;
+		cfg << "nagents " << dim << endl;
+		cfg << "enableRuntimeOptimization " << (jit ? "yes" : "no") << endl;
+		cfg << "binaryio no" << endl;
+	}
+	if (chdir(tmpdir))
+	{
+		cerr << "Cannot change directory to " << tmpdir << endl;
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!handle)
+	{
+		cerr << "Cannot load plugin: " << dlerror() << endl;
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+}
+
+// Plugin itself is not unloaded, as it registers MPI_Finalize hooks.
+Plugin::~Plugin()
+{
+	unlink(config.c_str());
+	rmdir(directory.c_str());
+}
+
+void* Plugin::getSymbol(const char* name) const
+{
+	return dlsym(handle, name);
+}
+
+Data* Plugin::getData(int nstates) const
+{
+	typedef Data* (*GetDataFunc)(int nstates);
+	GetDataFunc getData = (GetDataFunc)getSymbol("getData");
+	if (!getData)
+	{
+		cerr << "Cannot find getData in plugin: " << dlerror() << endl;
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	return getData(nstates);
+}
+
+Interpolator* Plugin::getInterpolator() const
+{
+	typedef Interpolator* (*GetInterpolatorFunc)();
+	GetInterpolatorFunc getInterpolator = (GetInterpolatorFunc)getSymbol("getInterpolator");
+	if (!getInterpolator)
+	{
+		cerr << "Cannot find getInterpolator in plugin: " << dlerror() << endl;
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	return getInterpolator();
+}
+
+int Plugin::getDim(const char* filename)
+{
+	int dim = 0;
+	ifstream infile(filename, ifstream::binary);
+	char marker[] = "compressed";
+	infile.read(marker, strlen(marker));
+	if (!strcmp(marker, "compressed"))
+		infile.read(reinterpret_cast<char*>(&dim), sizeof(int));
+	else
+	{
+		infile.clear();
+		infile.seekg(0);
+		infile >> dim;
+	}
+	if (!infile.good() || (dim <= 0))
+	{
+		cerr << "Cannot read header of data file: " << filename << endl;
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	return dim;
+}
+
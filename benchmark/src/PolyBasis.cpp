@@ -0,0 +1,142 @@
+#include "Benchmark.h"
+#include "Data.h"
+#include "JIT.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+using namespace std;
+
+// Single value and stateless kernels are not implemented in PolyBasis.
+
+extern "C" void PolyBasis_CPU_Generic_InterpolateArray(
+	const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const double* x,
+	const Matrix<int>& index, const Matrix<double>& surplus, double* value);
+
+extern "C" void PolyBasis_CPU_Generic_InterpolateArrayManyMultistate(
+	const int dim, const int nno,
+	const int Dof_choice_start, const int Dof_choice_end, const int count, const double* const* x_,
+	const std::vector<Matrix<int> >& index_, const std::vector<Matrix<double> >& surplus_, double** value_);
+
+// Runtime-optimized kernel falls back to generic, if compilation fails.
+static const char* getVariant(int jit, void* func, void* generic)
+{
+	if (!jit) return "generic";
+	if (func == generic) return "jit-fallback";
+	return "jit";
+}
+
+class PolyBasisBackend : public Backend
+{
+public :
+
+	const char* getName() const { return "PolyBasis"; }
+
+	void run(const Grid& grid, const Config& config, int repeat, vector<Result>& results);
+};
+
+void PolyBasisBackend::run(const Grid& grid, const Config& config, int repeat, vector<Result>& results)
+{
+	const int dim = grid.dim, nno = grid.nno, TotalDof = grid.TotalDof, count = config.count;
+
+	// Every state of multistate kernel gets its own copy of grid.
+	vector<Matrix<int> > index(count, Matrix<int>(nno, 2 * grid.vdim));
+	vector<Matrix<double> > surplus(count, Matrix<double>(nno, TotalDof));
+	for (int s = 0; s < count; s++)
+		for (int i = 0; i < nno; i++)
+		{
+			for (int j = 0; j < 2 * grid.vdim; j++)
+				index[s](i, j) = grid.index[i * 2 * grid.vdim + j];
+			for (int j = 0; j < TotalDof; j++)
+				surplus[s](i, j) = grid.surplus[i * TotalDof + j];
+		}
+
+	unsigned int seed = 1;
+	vector<Vector<double> > xs(count, Vector<double>(grid.vdim));
+	vector<const double*> pxs(count);
+	for (int s = 0; s < count; s++)
+	{
+		for (int i = 0; i < dim; i++)
+			xs[s](i) = (double)rand_r(&seed) / RAND_MAX;
+		pxs[s] = xs[s].getData();
+	}
+
+	vector<Vector<double> > values(count, Vector<double>(TotalDof));
+	vector<double*> pvalues(count);
+	for (int s = 0; s < count; s++)
+		pvalues[s] = values[s].getData();
+
+	// Upper bound: every row of index and surplus is streamed once per point.
+	const double rowBytes = 2 * grid.vdim * sizeof(int) + TotalDof * sizeof(double);
+
+	// Poison outputs, so that unwritten values are caught by comparison.
+	const double nan = numeric_limits<double>::quiet_NaN();
+	auto poison = [&]()
+	{
+		for (int s = 0; s < count; s++)
+			std::fill(pvalues[s], pvalues[s] + TotalDof, nan);
+	};
+
+	Result result;
+	result.backend = getName();
+	result.config = config;
+
+	Reference arrayReference, multistateReference;
+
+	// Variants: generic (scalar, reference) and runtime-optimized.
+	for (int jit = 0; jit <= 1; jit++)
+	{
+		InterpolateArrayFunc array = (InterpolateArrayFunc)PolyBasis_CPU_Generic_InterpolateArray;
+		InterpolateArrayManyMultistateFunc multistate =
+			(InterpolateArrayManyMultistateFunc)PolyBasis_CPU_Generic_InterpolateArrayManyMultistate;
+
+		if (jit)
+		{
+			array = JIT::jitCompile(dim, "PolyBasis_CPU_RuntimeOpt_InterpolateArray_", array).getFunc();
+			multistate = JIT::jitCompile(dim, "PolyBasis_CPU_RuntimeOpt_InterpolateArrayManyMultistate_", multistate).getFunc();
+		}
+
+		result.kernel = "InterpolateArray";
+		result.variant = getVariant(jit, (void*)array, (void*)PolyBasis_CPU_Generic_InterpolateArray);
+		poison();
+		check([&]()
+		{
+			array(dim, nno, 0, TotalDof - 1, pxs[0], index[0], surplus[0], pvalues[0]);
+		},
+		[&](vector<double>& output)
+		{
+			output.assign(pvalues[0], pvalues[0] + TotalDof);
+		},
+		repeat, arrayReference, result);
+		result.rows = nno;
+		result.bytes = nno * rowBytes;
+		results.push_back(result);
+
+		result.kernel = "InterpolateArrayManyMultistate";
+		result.variant = getVariant(jit, (void*)multistate, (void*)PolyBasis_CPU_Generic_InterpolateArrayManyMultistate);
+		poison();
+		check([&]()
+		{
+			multistate(dim, nno, 0, TotalDof - 1, count, &pxs[0], index, surplus, &pvalues[0]);
+		},
+		[&](vector<double>& output)
+		{
+			output.clear();
+			for (int s = 0; s < count; s++)
+				output.insert(output.end(), pvalues[s], pvalues[s] + TotalDof);
+		},
+		repeat, multistateReference, result);
+		result.rows = (double)nno * count;
+		result.bytes = count * nno * rowBytes;
+		results.push_back(result);
+	}
+}
+
+Backend* getPolyBasisBackend()
+{
+	static PolyBasisBackend backend;
+	return &backend;
+}
+
@@ -0,0 +1,272 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Synthetic sparse grid generator. Writes the same grid in both formats
+// Data::load understands: text (<output>.txt) and compressed (<output>.bin).
+//
+// Nodes are built by hierarchical refinement of the Clenshaw-Curtis grid
+// from the root, up to the given level: with refinement probability 1 this
+// gives the regular Smolyak grid, smaller probabilities give sparser grids,
+// similar to those produced by adaptive refinement.
+
+// Node level and position index in every dimension, as written into
+// text file: level "l", and "j" such that x = (j - 1) / 2^(l - 1) for l > 1
+// (level 1 has the only node x = 1 / 2).
+struct Node
+{
+	vector<int> l, j;
+
+	bool operator<(const Node& other) const
+	{
+		if (l != other.l) return l < other.l;
+		return j < other.j;
+	}
+};
+
+// Children of 1D node on the next level.
+static void getChildren(int l, int j, vector<int>& children)
+{
+	children.clear();
+	if (l == 1)
+	{
+		// x = 0 and x = 1.
+		children.push_back(1);
+		children.push_back(3);
+	}
+	else if (l == 2)
+	{
+		// x = 1 / 4 and x = 3 / 4.
+		children.push_back((j == 1) ? 2 : 4);
+	}
+	else
+	{
+		// x = (j - 1) / 2^(l - 1) -> x -/+ 1 / 2^l.
+		children.push_back(2 * (j - 1));
+		children.push_back(2 * (j - 1) + 2);
+	}
+}
+
+static void usage(const char* name)
+{
+	cerr << "Usage: " << name << " --dim <dim> --level <level> --dof <TotalDof> --output <prefix>" << endl;
+	cerr << "\t[--refine <probability, 1 = Smolyak>] [--max-nno <nno>] [--decay <surplus decay per level>]" << endl;
+	cerr << "\t[--sparsity <fraction of zero surpluses>] [--seed <seed>]" << endl;
+}
+
+// Write IA as deltas and JA with the element size Data::load selects.
+template<typename T>
+static void writeCSR(ofstream& out, const vector<int>& IA, const vector<int>& JA)
+{
+	for (int i = 0, e = IA.size(); i != e; i++)
+	{
+		T value = i ? IA[i] - IA[i - 1] : IA[0];
+		out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+	for (int i = 0, e = JA.size(); i != e; i++)
+	{
+		T value = JA[i];
+		out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+}
+
+static void writeCSR(ofstream& out, int ncols, const vector<int>& IA, const vector<int>& JA)
+{
+	if (ncols <= numeric_limits<unsigned char>::max())
+		writeCSR<unsigned char>(out, IA, JA);
+	else if (ncols <= numeric_limits<unsigned short>::max())
+		writeCSR<unsigned short>(out, IA, JA);
+	else
+		writeCSR<unsigned int>(out, IA, JA);
+}
+
+static int getSize(int ncols)
+{
+	if (ncols <= numeric_limits<unsigned char>::max())
+		return 1;
+	if (ncols <= numeric_limits<unsigned short>::max())
+		return 2;
+	return 4;
+}
+
+int main(int argc, char* argv[])
+{
+	int dim = 0, level = 0, TotalDof = 0, maxNno = 1000000;
+	double refine = 1.0, decay = 0.5, sparsity = 0.0;
+	unsigned int seed = 0;
+	string output = "";
+
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		const char* arg = argv[i];
+		const char* value = argv[i + 1];
+		if (!strcmp(arg, "--dim")) dim = atoi(value);
+		else if (!strcmp(arg, "--level")) level = atoi(value);
+		else if (!strcmp(arg, "--dof")) TotalDof = atoi(value);
+		else if (!strcmp(arg, "--output")) output = value;
+		else if (!strcmp(arg, "--refine")) refine = atof(value);
+		else if (!strcmp(arg, "--max-nno")) maxNno = atoi(value);
+		else if (!strcmp(arg, "--decay")) decay = atof(value);
+		else if (!strcmp(arg, "--sparsity")) sparsity = atof(value);
+		else if (!strcmp(arg, "--seed")) seed = atoi(value);
+		else
+		{
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if ((dim <= 0) || (level <= 0) || (TotalDof <= 0) || (output == "") || (argc % 2 == 0))
+	{
+		usage(argv[0]);
+		return -1;
+	}
+
+	// Breadth-first refinement from the root, so that truncation
+	// by max-nno drops the finest levels first.
+	set<Node> visited;
+	vector<Node> nodes;
+	{
+		Node root;
+		root.l.assign(dim, 1);
+		root.j.assign(dim, 1);
+		visited.insert(root);
+		nodes.push_back(root);
+	}
+	vector<int> children;
+	for (int n = 0; (n < nodes.size()) && (nodes.size() < maxNno); n++)
+	{
+		int sum = 0;
+		for (int k = 0; k < dim; k++)
+			sum += nodes[n].l[k] - 1;
+		if (sum + 1 >= level) continue;
+
+		for (int k = 0; (k < dim) && (nodes.size() < maxNno); k++)
+		{
+			getChildren(nodes[n].l[k], nodes[n].j[k], children);
+			for (int c = 0; (c < children.size()) && (nodes.size() < maxNno); c++)
+			{
+				if ((double)rand_r(&seed) / RAND_MAX > refine) continue;
+
+				Node child = nodes[n];
+				child.l[k]++;
+				child.j[k] = children[c];
+				if (visited.insert(child).second)
+					nodes.push_back(child);
+			}
+		}
+	}
+
+	const int nno = nodes.size();
+
+	// Surpluses decay with the total level of node.
+	vector<double> surplus(nno * TotalDof);
+	for (int i = 0; i < nno; i++)
+	{
+		int sum = 0;
+		for (int k = 0; k < dim; k++)
+			sum += nodes[i].l[k] - 1;
+		for (int d = 0; d < TotalDof; d++)
+		{
+			if ((double)rand_r(&seed) / RAND_MAX < sparsity) continue;
+
+			double sign = (rand_r(&seed) % 2) ? 1.0 : -1.0;
+			surplus[i * TotalDof + d] = sign * pow(decay, sum) * (0.5 + (double)rand_r(&seed) / RAND_MAX);
+		}
+	}
+
+	// Text format.
+	{
+		ofstream out((output + ".txt").c_str());
+		out.precision(17);
+		out << dim << " " << nno << " " << TotalDof << " " << level << endl;
+		for (int i = 0; i < nno; i++)
+		{
+			for (int k = 0; k < dim; k++)
+				out << nodes[i].l[k] << " ";
+			for (int k = 0; k < dim; k++)
+				out << nodes[i].j[k] << " ";
+			for (int d = 0; d < TotalDof; d++)
+				out << surplus[i * TotalDof + d] << " ";
+			out << endl;
+		}
+	}
+
+	// Compressed format, with index already decoded the way
+	// Data::load does for text format.
+	{
+		ofstream out((output + ".bin").c_str(), ofstream::binary);
+		out.write("compressed", strlen("compressed"));
+		out.write(reinterpret_cast<const char*>(&dim), sizeof(int));
+		out.write(reinterpret_cast<const char*>(&nno), sizeof(int));
+		out.write(reinterpret_cast<const char*>(&TotalDof), sizeof(int));
+		out.write(reinterpret_cast<const char*>(&level), sizeof(int));
+
+		struct IndexPair
+		{
+			unsigned short i, j;
+		};
+
+		vector<IndexPair> A;
+		vector<int> IA(1, 0), JA;
+		for (int n = 0; n < nno; n++)
+		{
+			for (int k = 0; k < dim; k++)
+			{
+				// Level 1 basis is constant, and is stored as zero.
+				if (nodes[n].l[k] == 1) continue;
+
+				IndexPair pair;
+				pair.i = 2 << (nodes[n].l[k] - 2);
+				pair.j = nodes[n].j[k] - 1;
+				A.push_back(pair);
+				JA.push_back(k);
+			}
+			IA.push_back(JA.size());
+		}
+
+		out.write("index", strlen("index"));
+		unsigned int nonzeros = A.size();
+		out.write(reinterpret_cast<const char*>(&nonzeros), sizeof(unsigned int));
+		if (nonzeros)
+			out.write(reinterpret_cast<const char*>(&A[0]), nonzeros * sizeof(IndexPair));
+		writeCSR(out, dim, IA, JA);
+
+		vector<double> S;
+		IA.assign(1, 0);
+		JA.clear();
+		for (int n = 0; n < nno; n++)
+		{
+			for (int d = 0; d < TotalDof; d++)
+			{
+				if (surplus[n * TotalDof + d] == 0.0) continue;
+
+				S.push_back(surplus[n * TotalDof + d]);
+				JA.push_back(d);
+			}
+			IA.push_back(JA.size());
+		}
+
+		out.write("surplus", strlen("surplus"));
+		nonzeros = S.size();
+		out.write(reinterpret_cast<const char*>(&nonzeros), sizeof(unsigned int));
+		if (nonzeros)
+			out.write(reinterpret_cast<const char*>(&S[0]), nonzeros * sizeof(double));
+		writeCSR(out, TotalDof, IA, JA);
+	}
+
+	cout << "Generated " << nno << " nodes, dim = " << dim << ", level = " << level <<
+		", TotalDof = " << TotalDof << ", " << getSize(dim) << "-byte index IA/JA, " <<
+		getSize(TotalDof) << "-byte surplus IA/JA" << endl;
+
+	return 0;
+}
+
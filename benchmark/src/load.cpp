@@ -0,0 +1,137 @@
+#include "Plugin.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <limits.h>
+#include <mpi.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Load throughput benchmark: loads data file with Data::load of
+// the given postprocessor plugin, and reports load time and bandwidth.
+// If plugin is built with tracing support (LinearBasis), time of every
+// load phase is reported as well.
+
+typedef double (*GetTotalFunc)(const char* name);
+
+// Load phases recorded by LinearBasis tracer.
+static const char* phases[] = { "open", "header", "text decode", "index decode", "surplus decode" };
+
+static void usage(const char* name)
+{
+	cerr << "Usage: " << name << " <libpostprocessor.so> <data file> [<data file> ...] [--repeat <count>]" << endl;
+	cerr << "Loads every data file with Data::load of the given postprocessor plugin," << endl;
+	cerr << "and prints the best load time and bandwidth as CSV to stdout." << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	MPI_Init(&argc, &argv);
+
+	int repeat = 3;
+	vector<string> filenames;
+	for (int i = 2; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--repeat") && (i + 1 < argc))
+		{
+			repeat = atoi(argv[++i]);
+			continue;
+		}
+
+		char path[PATH_MAX];
+		if (!realpath(argv[i], path))
+		{
+			cerr << "Cannot find data file: " << argv[i] << endl;
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		filenames.push_back(path);
+	}
+
+	if ((argc < 3) || filenames.empty() || (repeat <= 0))
+	{
+		usage(argv[0]);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	Plugin* plugin = new Plugin(argv[1], Plugin::getDim(filenames[0].c_str()));
+
+	// Tracer is enabled on interpolator creation, which also prints config:
+	// do it in advance, so that printout does not get into results.
+	string trace = plugin->getDirectory() + "/trace";
+	setenv("TRACE", trace.c_str(), 0);
+	plugin->getInterpolator();
+
+	GetTotalFunc getTotal = (GetTotalFunc)plugin->getSymbol("LinearBasis_CPU_Tracer_getTotal");
+
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+	if (!rank)
+	{
+		cout << "file,bytes,nno,seconds,MB_per_s";
+		if (getTotal)
+			for (int p = 0; p < sizeof(phases) / sizeof(phases[0]); p++)
+				cout << "," << phases[p];
+		cout << endl;
+	}
+
+	Data* data = plugin->getData(1);
+
+	for (int f = 0; f < filenames.size(); f++)
+	{
+		const char* filename = filenames[f].c_str();
+
+		struct stat st;
+		stat(filename, &st);
+
+		double best = numeric_limits<double>::max();
+		vector<double> bestPhases(sizeof(phases) / sizeof(phases[0]));
+		int nno = 0;
+		for (int r = 0; r < repeat; r++)
+		{
+			vector<double> before(bestPhases.size());
+			if (getTotal)
+				for (int p = 0; p < before.size(); p++)
+					before[p] = getTotal(phases[p]);
+
+			double start = MPI_Wtime();
+			data->load(filename, 0);
+			double seconds = MPI_Wtime() - start;
+
+			nno = data->getNno();
+			data->clear();
+
+			if (seconds >= best) continue;
+
+			best = seconds;
+			if (getTotal)
+				for (int p = 0; p < before.size(); p++)
+					bestPhases[p] = getTotal(phases[p]) - before[p];
+		}
+
+		if (rank) continue;
+
+		cout << filename << "," << st.st_size << "," << nno << "," << best << "," <<
+			st.st_size / best * 1e-6;
+		if (getTotal)
+			for (int p = 0; p < bestPhases.size(); p++)
+				cout << "," << bestPhases[p];
+		cout << endl;
+	}
+
+	// Data has no virtual destructor, thus it is left to the process exit.
+	MPI_Finalize();
+
+	// Tracer of the plugin writes its timeline at finalize.
+	unlink((trace + "." + to_string(rank) + ".json").c_str());
+	delete plugin;
+
+	return 0;
+}
+
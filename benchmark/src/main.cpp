@@ -0,0 +1,145 @@
+#include "Benchmark.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mpi.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Parse comma-separated list of integers.
+static vector<int> parseList(const char* arg)
+{
+	vector<int> result;
+	stringstream ss(arg);
+	string item;
+	while (getline(ss, item, ','))
+		result.push_back(atoi(item.c_str()));
+	return result;
+}
+
+static void usage(const char* name)
+{
+	cerr << "Usage: " << name << " [--backend LinearBasis|PolyBasis] [--dim 4,16,59] [--nno 1000,100000]" << endl;
+	cerr << "\t[--dof 1,16] [--count 1,16] [--repeat 10] [--tolerance 1e-12]" << endl;
+	cerr << "Times every kernel variant (scalar, generic and JIT) over all combinations of dim," << endl;
+	cerr << "nno, TotalDof and count, checks their outputs against the scalar reference, and" << endl;
+	cerr << "prints results as CSV to stdout. Exits with error, if any relative error exceeds" << endl;
+	cerr << "the tolerance." << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	MPI_Init(&argc, &argv);
+
+	vector<int> dims = parseList("4,16,59");
+	vector<int> nnos = parseList("1000,100000");
+	vector<int> dofs = parseList("1,16");
+	vector<int> counts = parseList("1,16");
+	int repeat = 10;
+	double tolerance = 1e-12;
+	vector<Backend*> backends;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (i + 1 == argc)
+		{
+			usage(argv[0]);
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+
+		const char* arg = argv[i++];
+		if (!strcmp(arg, "--backend"))
+		{
+			if (!strcmp(argv[i], "LinearBasis"))
+				backends.push_back(getLinearBasisBackend());
+			else if (!strcmp(argv[i], "PolyBasis"))
+				backends.push_back(getPolyBasisBackend());
+			else
+			{
+				usage(argv[0]);
+				MPI_Abort(MPI_COMM_WORLD, -1);
+			}
+		}
+		else if (!strcmp(arg, "--dim"))
+			dims = parseList(argv[i]);
+		else if (!strcmp(arg, "--nno"))
+			nnos = parseList(argv[i]);
+		else if (!strcmp(arg, "--dof"))
+			dofs = parseList(argv[i]);
+		else if (!strcmp(arg, "--count"))
+			counts = parseList(argv[i]);
+		else if (!strcmp(arg, "--repeat"))
+			repeat = atoi(argv[i]);
+		else if (!strcmp(arg, "--tolerance"))
+			tolerance = atof(argv[i]);
+		else
+		{
+			usage(argv[0]);
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+	}
+
+	if (backends.empty())
+	{
+		backends.push_back(getLinearBasisBackend());
+		backends.push_back(getPolyBasisBackend());
+	}
+
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+	if (!rank)
+		cout << "backend,kernel,variant,dim,nno,TotalDof,count,seconds,ns_per_row,GB_per_s," <<
+			"max_abs_error,max_rel_error,speedup" << endl;
+
+	int failed = 0;
+
+	for (int b = 0; b < backends.size(); b++)
+		for (int d = 0; d < dims.size(); d++)
+			for (int n = 0; n < nnos.size(); n++)
+				for (int f = 0; f < dofs.size(); f++)
+				{
+					Grid grid(dims[d], nnos[n], dofs[f]);
+
+					for (int c = 0; c < counts.size(); c++)
+					{
+						Config config;
+						config.dim = dims[d];
+						config.nno = nnos[n];
+						config.TotalDof = dofs[f];
+						config.count = counts[c];
+
+						vector<Result> results;
+						backends[b]->run(grid, config, repeat, results);
+
+						if (rank) continue;
+
+						for (int r = 0; r < results.size(); r++)
+						{
+							const Result& result = results[r];
+							cout << result.backend << "," << result.kernel << "," << result.variant << "," <<
+								config.dim << "," << config.nno << "," << config.TotalDof << "," << config.count << "," <<
+								result.seconds << "," << result.seconds * 1e9 / result.rows << "," <<
+								result.bytes / result.seconds * 1e-9 << "," <<
+								result.maxAbsError << "," << result.maxRelError << "," << result.speedup << endl;
+
+							// Written to catch NaN.
+							if (!(result.maxRelError <= tolerance))
+							{
+								cerr << result.backend << " " << result.kernel << " " << result.variant <<
+									" mismatches reference: relative error " << result.maxRelError << endl;
+								failed = 1;
+							}
+						}
+					}
+				}
+
+	MPI_Finalize();
+
+	return failed;
+}
+
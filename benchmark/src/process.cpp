@@ -0,0 +1,36 @@
+#include "process.h"
+
+#include <mpi.h>
+
+// Stub of the solver's MPI process, enough for backends to run standalone.
+
+bool MPI_Process::isMaster() const { return getRank() == getRoot(); }
+
+int MPI_Process::getRoot() const { return 0; }
+
+int MPI_Process::getRank() const
+{
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	return rank;
+}
+
+int MPI_Process::getSize() const
+{
+	int size;
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+	return size;
+}
+
+void MPI_Process::abort()
+{
+	MPI_Abort(MPI_COMM_WORLD, -1);
+}
+
+extern "C" int MPI_Process_get(MPI_Process** process)
+{
+	static MPI_Process instance;
+	*process = &instance;
+	return MPI_SUCCESS;
+}
+
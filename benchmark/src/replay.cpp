@@ -0,0 +1,381 @@
+#include "Plugin.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits.h>
+#include <mpi.h>
+#include <pthread.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+
+// Replay of interpolation calls recorded by LinearBasis CPU interpolator
+// with RECORD=<prefix> (see LinearBasis/cpu/include/Recorder.h), against
+// data loaded with the given plugin. Each recorded thread keeps its order
+// of calls: calls of recorded thread t are replayed by thread t % threads.
+// Reports throughput and latency percentiles per kernel as CSV to stdout.
+
+// Keep in sync with LinearBasis/cpu/include/Recorder.h.
+struct Header
+{
+	char magic[8];
+	int version;
+	int realSize;
+};
+
+struct Call
+{
+	unsigned char kind;
+	unsigned char reserved;
+	unsigned short thread;
+	int dim;
+	int istate;
+	int Dof_choice_start;
+	int Dof_choice_end;
+	int count;
+	long long time;
+};
+
+// Keep in sync with KernelKind of LinearBasis/cpu/include/KernelRegistry.h.
+enum Kind
+{
+	InterpolateValueKind = 1,
+	InterpolateArrayKind,
+	InterpolateArrayManyStatelessKind,
+	InterpolateArrayManyMultistateKind,
+	KindCount
+};
+
+static const char* kindNames[] =
+{
+	"all", "InterpolateValue", "InterpolateArray",
+	"InterpolateArrayManyStateless", "InterpolateArrayManyMultistate"
+};
+
+// Recorded call with its x copied into aligned storage: every state vector
+// of multistate call starts at aligned offset, as kernels expect.
+struct Replay
+{
+	Call call;
+	size_t x;
+	int vdim;
+};
+
+struct Context
+{
+	Interpolator* interp;
+	Data* data;
+	const vector<Replay>* replays;
+	const double* x;
+	int TotalDof;
+	int repeat;
+	bool warmup;
+	pthread_barrier_t* barrier;
+
+	// Call indexes of this thread, and latencies of each replay in ns.
+	vector<int> calls;
+	vector<long long> latencies;
+};
+
+static inline long long now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void execute(Context& context, const Replay& replay, vector<double>& value, vector<double*>& values, vector<const double*>& xs)
+{
+	const Call& call = replay.call;
+	const double* x = context.x + replay.x;
+	switch (call.kind)
+	{
+	case InterpolateValueKind :
+		context.interp->interpolate(NULL, context.data, call.istate, x, call.Dof_choice_start, value[0]);
+		break;
+	case InterpolateArrayKind :
+		context.interp->interpolate(NULL, context.data, call.istate, x,
+			call.Dof_choice_start, call.Dof_choice_end, &value[0]);
+		break;
+	case InterpolateArrayManyStatelessKind :
+		context.interp->interpolate(NULL, context.data, call.istate, x,
+			call.Dof_choice_start, call.Dof_choice_end, call.count, &value[0]);
+		break;
+	case InterpolateArrayManyMultistateKind :
+		for (int i = 0; i < call.count; i++)
+			xs[i] = x + i * replay.vdim;
+		context.interp->interpolate(NULL, context.data, &xs[0],
+			call.Dof_choice_start, call.Dof_choice_end, &values[0]);
+		break;
+	}
+}
+
+static void* thread(void* arg)
+{
+	Context& context = *(Context*)arg;
+	const vector<Replay>& replays = *context.replays;
+
+	// Output buffers are large enough for any call.
+	int maxCount = 1;
+	for (int i = 0; i < context.calls.size(); i++)
+		maxCount = max(maxCount, replays[context.calls[i]].call.count);
+	vector<double> value(maxCount * context.TotalDof);
+	vector<vector<double> > states(maxCount, vector<double>(context.TotalDof));
+	vector<double*> values(maxCount);
+	for (int i = 0; i < maxCount; i++)
+		values[i] = &states[i][0];
+	vector<const double*> xs(maxCount);
+
+	if (context.warmup)
+		for (int i = 0; i < context.calls.size(); i++)
+			execute(context, replays[context.calls[i]], value, values, xs);
+
+	context.latencies.resize(context.calls.size() * context.repeat);
+
+	pthread_barrier_wait(context.barrier);
+
+	for (int r = 0, l = 0; r < context.repeat; r++)
+		for (int i = 0; i < context.calls.size(); i++, l++)
+		{
+			long long start = now();
+			execute(context, replays[context.calls[i]], value, values, xs);
+			context.latencies[l] = now() - start;
+		}
+
+	pthread_barrier_wait(context.barrier);
+
+	return NULL;
+}
+
+static double getPercentile(const vector<long long>& sorted, double p)
+{
+	size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+	return sorted[i] * 1e-3;
+}
+
+static void usage(const char* name)
+{
+	cerr << "Usage: " << name << " <libpostprocessor.so> <record> <data file for state 0> [<data file for state 1> ...]" << endl;
+	cerr << "\t[--threads <count, 0 = as recorded>] [--repeat <count>] [--warmup 0|1] [--jit 0|1]" << endl;
+	cerr << "Replays recorded interpolation calls against the given data, and prints" << endl;
+	cerr << "throughput and latency percentiles per kernel as CSV to stdout." << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	MPI_Init(&argc, &argv);
+
+	int nthreads = 0, repeat = 1;
+	bool warmup = true, jit = false;
+	vector<string> filenames;
+	for (int i = 3; i < argc; i++)
+	{
+		if (!strncmp(argv[i], "--", 2) && (i + 1 < argc))
+		{
+			const char* arg = argv[i++];
+			if (!strcmp(arg, "--threads")) nthreads = atoi(argv[i]);
+			else if (!strcmp(arg, "--repeat")) repeat = atoi(argv[i]);
+			else if (!strcmp(arg, "--warmup")) warmup = atoi(argv[i]);
+			else if (!strcmp(arg, "--jit")) jit = atoi(argv[i]);
+			else
+			{
+				usage(argv[0]);
+				MPI_Abort(MPI_COMM_WORLD, -1);
+			}
+			continue;
+		}
+
+		char path[PATH_MAX];
+		if (!realpath(argv[i], path))
+		{
+			cerr << "Cannot find data file: " << argv[i] << endl;
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		filenames.push_back(path);
+	}
+
+	if ((argc < 4) || filenames.empty() || (nthreads < 0) || (repeat <= 0))
+	{
+		usage(argv[0]);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	const int nstates = filenames.size();
+	const int dim = Plugin::getDim(filenames[0].c_str());
+
+	// Read all recorded calls, copying x into aligned storage.
+	vector<Replay> replays;
+	vector<double> xstorage;
+	int TotalDof = 1, nrecorded = 0;
+	{
+		FILE* file = fopen(argv[2], "rb");
+		if (!file)
+		{
+			cerr << "Cannot open record file " << argv[2] << endl;
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+
+		Header header;
+		if ((fread(&header, sizeof(header), 1, file) != 1) || strcmp(header.magic, "hddmrec") ||
+			(header.version != 1) || (header.realSize != sizeof(double)))
+		{
+			cerr << "Unsupported record file " << argv[2] << endl;
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+
+		// Vector size of kernels is 4 doubles, or 32 bytes.
+		const int vdim = (dim + 3) / 4 * 4;
+
+		Replay replay;
+		vector<double> x;
+		while (fread(&replay.call, sizeof(Call), 1, file) == 1)
+		{
+			const Call& call = replay.call;
+			if ((call.kind < InterpolateValueKind) || (call.kind >= KindCount) || (call.dim != dim) ||
+				(call.istate >= nstates) || ((call.istate < 0) && (call.count != nstates)))
+			{
+				cerr << "Recorded call #" << replays.size() << " does not match the given data" << endl;
+				MPI_Abort(MPI_COMM_WORLD, -1);
+			}
+
+			x.resize(call.count * dim);
+			if (fread(&x[0], sizeof(double), x.size(), file) != x.size())
+			{
+				cerr << "Truncated record file " << argv[2] << endl;
+				MPI_Abort(MPI_COMM_WORLD, -1);
+			}
+
+			replay.x = xstorage.size();
+			replay.vdim = vdim;
+			if (call.kind == InterpolateArrayManyMultistateKind)
+			{
+				xstorage.resize(replay.x + call.count * vdim);
+				for (int i = 0; i < call.count; i++)
+					copy(&x[i * dim], &x[i * dim] + dim, &xstorage[replay.x + i * vdim]);
+			}
+			else
+			{
+				xstorage.resize(replay.x + (call.count * dim + 3) / 4 * 4);
+				copy(x.begin(), x.end(), &xstorage[replay.x]);
+			}
+
+			TotalDof = max(TotalDof, call.Dof_choice_end + 1);
+			nrecorded = max(nrecorded, call.thread + 1);
+			replays.push_back(replay);
+		}
+
+		fclose(file);
+	}
+
+	if (!nthreads) nthreads = nrecorded;
+
+	double* x;
+	if (posix_memalign((void**)&x, 32, max((size_t)1, xstorage.size()) * sizeof(double)))
+	{
+		cerr << "Cannot allocate " << xstorage.size() * sizeof(double) << " bytes" << endl;
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+	copy(xstorage.begin(), xstorage.end(), x);
+	vector<double>().swap(xstorage);
+
+	Plugin* plugin = new Plugin(argv[1], dim, jit);
+
+	// Replay shall not record itself.
+	unsetenv("RECORD");
+
+	Interpolator* interp = plugin->getInterpolator();
+	Data* data = plugin->getData(nstates);
+	for (int i = 0; i < nstates; i++)
+		data->load(filenames[i].c_str(), i);
+
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, nthreads + 1);
+
+	vector<Context> contexts(nthreads);
+	for (int t = 0; t < nthreads; t++)
+	{
+		Context& context = contexts[t];
+		context.interp = interp;
+		context.data = data;
+		context.replays = &replays;
+		context.x = x;
+		context.TotalDof = TotalDof;
+		context.repeat = repeat;
+		context.warmup = warmup;
+		context.barrier = &barrier;
+	}
+	for (int i = 0; i < replays.size(); i++)
+		contexts[replays[i].call.thread % nthreads].calls.push_back(i);
+
+	vector<pthread_t> threads(nthreads);
+	for (int t = 0; t < nthreads; t++)
+		pthread_create(&threads[t], NULL, thread, &contexts[t]);
+
+	// Time from all threads ready to all threads done.
+	pthread_barrier_wait(&barrier);
+	long long start = now();
+	pthread_barrier_wait(&barrier);
+	double seconds = (now() - start) * 1e-9;
+
+	for (int t = 0; t < nthreads; t++)
+		pthread_join(threads[t], NULL);
+
+	// Group latencies by kernel, index 0 is for all kernels.
+	vector<vector<long long> > latencies(KindCount);
+	vector<double> points(KindCount);
+	for (int t = 0; t < nthreads; t++)
+	{
+		const Context& context = contexts[t];
+		for (int r = 0, l = 0; r < repeat; r++)
+			for (int i = 0; i < context.calls.size(); i++, l++)
+			{
+				const Call& call = replays[context.calls[i]].call;
+				latencies[0].push_back(context.latencies[l]);
+				latencies[call.kind].push_back(context.latencies[l]);
+				points[0] += call.count;
+				points[call.kind] += call.count;
+			}
+	}
+
+	int rank;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+	if (!rank)
+	{
+		cout << "kernel,threads,calls,points,seconds,calls_per_s,points_per_s," <<
+			"mean_us,p50_us,p90_us,p99_us,p999_us,max_us" << endl;
+		for (int k = 0; k < KindCount; k++)
+		{
+			vector<long long>& sorted = latencies[k];
+			if (sorted.empty()) continue;
+			sort(sorted.begin(), sorted.end());
+
+			double mean = 0;
+			for (int i = 0; i < sorted.size(); i++)
+				mean += sorted[i];
+			mean /= sorted.size();
+
+			cout << kindNames[k] << "," << nthreads << "," << sorted.size() << "," << points[k] << "," <<
+				seconds << "," << sorted.size() / seconds << "," << points[k] / seconds << "," <<
+				mean * 1e-3 << "," << getPercentile(sorted, 0.5) << "," << getPercentile(sorted, 0.9) << "," <<
+				getPercentile(sorted, 0.99) << "," << getPercentile(sorted, 0.999) << "," <<
+				sorted.back() * 1e-3 << endl;
+		}
+	}
+
+	pthread_barrier_destroy(&barrier);
+	free(x);
+
+	// Data has no virtual destructor, thus it is left to the process exit.
+	MPI_Finalize();
+
+	delete plugin;
+
+	return 0;
+}
+
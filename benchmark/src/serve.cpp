@@ -0,0 +1,116 @@
+#include "Plugin.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits.h>
+#include <mpi.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Local interpolation server: loads data files with the given
+// postprocessor plugin (LinearBasis), and serves interpolation requests
+// of other processes on the node, until stopped with --stop.
+
+typedef void (*RunServerFunc)(const Data* data, const char* path);
+typedef void* (*ConnectServerFunc)(const char* path);
+typedef void (*ClientFunc)(void* client);
+typedef void (*TuneFunc)(Data* data);
+
+static void usage(const char* name)
+{
+	cerr << "Usage: " << name << " <libpostprocessor.so> <socket> <data file for state 0> [<data file for state 1> ...]" << endl;
+	cerr << "       " << name << " <libpostprocessor.so> <socket> --stop" << endl;
+	cerr << "Serves interpolation of the given data to local clients on the given" << endl;
+	cerr << "Unix socket, or stops the server listening on it." << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	MPI_Init(&argc, &argv);
+
+	if (argc < 4)
+	{
+		usage(argv[0]);
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	// Plugin moves into temporary directory, thus paths are made absolute.
+	string socket = argv[2];
+	if (socket[0] != '/')
+	{
+		char cwd[PATH_MAX];
+		if (getcwd(cwd, sizeof(cwd)))
+			socket = (string)cwd + "/" + socket;
+	}
+
+	if (!strcmp(argv[3], "--stop"))
+	{
+		Plugin* plugin = new Plugin(argv[1], 1);
+		ConnectServerFunc connectServer = (ConnectServerFunc)plugin->getSymbol("connectServer");
+		ClientFunc stopServer = (ClientFunc)plugin->getSymbol("stopServer");
+		ClientFunc disconnectServer = (ClientFunc)plugin->getSymbol("disconnectServer");
+		if (!connectServer || !stopServer || !disconnectServer)
+		{
+			cerr << "Plugin has no server support" << endl;
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+
+		void* client = connectServer(socket.c_str());
+		if (!client)
+		{
+			cerr << "No server on " << socket << endl;
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		stopServer(client);
+		disconnectServer(client);
+
+		MPI_Finalize();
+		delete plugin;
+		return 0;
+	}
+
+	vector<string> filenames;
+	for (int i = 3; i < argc; i++)
+	{
+		char path[PATH_MAX];
+		if (!realpath(argv[i], path))
+		{
+			cerr << "Cannot find data file: " << argv[i] << endl;
+			MPI_Abort(MPI_COMM_WORLD, -1);
+		}
+		filenames.push_back(path);
+	}
+
+	const int nstates = filenames.size();
+	const int dim = Plugin::getDim(filenames[0].c_str());
+
+	Plugin* plugin = new Plugin(argv[1], dim);
+	RunServerFunc runServer = (RunServerFunc)plugin->getSymbol("runServer");
+	if (!runServer)
+	{
+		cerr << "Plugin has no server support" << endl;
+		MPI_Abort(MPI_COMM_WORLD, -1);
+	}
+
+	plugin->getInterpolator();
+	Data* data = plugin->getData(nstates);
+	for (int istate = 0; istate < nstates; istate++)
+		data->load(filenames[istate].c_str(), istate);
+
+	// Tune kernels for the served data, if AUTOTUNE is set.
+	TuneFunc tune = (TuneFunc)plugin->getSymbol("tune");
+	if (tune)
+		tune(data);
+
+	runServer(data, socket.c_str());
+
+	// Data has no virtual destructor, thus it is left to the process exit.
+	MPI_Finalize();
+	delete plugin;
+
+	return 0;
+}